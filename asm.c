@@ -3,66 +3,48 @@
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdint.h>
 
-// Input file.
-static FILE* fi;
+// Assembled image, loaded at 0x200 and led by the reset vector.
+static uint8_t image[4096 - 0x200];
 
-// Output file.
-static FILE* fo;
+// Bytes of the image written so far.
+static unsigned written;
 
-// Name of assembly file.
-static char* assem;
-
-// Name of hex file.
-static char* hexid;
+// Optional hex dump of the image, one instruction or byte per line.
+static FILE* dump;
 
 // Failure flag goes high if anything went wrong during assembly.
 static bool failure;
 
-// Cleans up files. Uses failure flag to remove output hex file.
-static void fshutdown()
-{
-    if(fi) fclose(fi);
-    if(fo) fclose(fo);
-    if(failure)
-        remove(hexid);
-}
-
-// Inits files.
-static void finit(char* argv[])
-{
-    assem = argv[1];
-    hexid = argv[2];
-    // Input
-    fi = fopen(argv[1], "r");
-    if(fi == NULL)
-    {
-        fprintf(stderr, "error: %s does not exist\n", assem);
-        exit(1);
-    }
-    // Output
-    fo = fopen(argv[2], "w");
-    if(fo == NULL)
-    {
-        fprintf(stderr, "error: %s cannot be made\n", hexid);
-        exit(1);
-    }
-    atexit(fshutdown);
-}
-
 // Duplicates a string.
-static char* dup(char* s)
+static char* dup(const char* s)
 {
     int len = strlen(s) + 1;
     char* p = (char*) malloc(len);
     return p ? (char*) memcpy(p, s, len) : NULL;
 }
 
-// Rewinds both the input and output files.
-static void frewind()
+// Returns the value of a hex digit.
+static unsigned nibble(const char c)
 {
-    rewind(fi);
-    rewind(fo);
+    return isdigit(c) ? c - '0' : toupper(c) - 'A' + 0xA;
+}
+
+// Appends an instruction (two bytes) or a byte to the image.
+static void emit(const unsigned value, const unsigned bytes)
+{
+    if(written + bytes > sizeof(image))
+    {
+        failure = true;
+        fprintf(stderr, "error: program too large\n");
+        exit(1);
+    }
+    if(bytes == 2)
+        image[written++] = value >> 8;
+    image[written++] = value;
+    if(dump)
+        fprintf(dump, bytes == 2 ? "%04X\n" : "%02X\n", value);
 }
 
 // Binary tree node.
@@ -76,7 +58,7 @@ struct node
 };
 
 // New binary tree node.
-static struct node* build(char* name, unsigned address)
+static struct node* build(const char* name, unsigned address)
 {
     struct node* node = (struct node*) malloc(sizeof(*node));
     node->name = dup(name);
@@ -119,6 +101,38 @@ static struct node* get(struct node* nodes, const char* name)
         return get(nodes->r, name);
 }
 
+// Flattens the binary tree into an array. Returns the new array length.
+static int flatten(struct node* nodes, struct node** array, int n)
+{
+    if(nodes == NULL)
+        return n;
+    n = flatten(nodes->l, array, n);
+    array[n++] = nodes;
+    return flatten(nodes->r, array, n);
+}
+
+static int byaddress(const void* a, const void* b)
+{
+    return (int) (*(struct node**) a)->address - (int) (*(struct node**) b)->address;
+}
+
+// Writes labels in address order, one per line, as: 0x202 main
+static void symbols(struct node* labels, const char* symid)
+{
+    FILE* const fs = fopen(symid, "w");
+    if(fs == NULL)
+    {
+        fprintf(stderr, "error: %s cannot be made\n", symid);
+        exit(1);
+    }
+    struct node* array[4096];
+    const int n = flatten(labels, array, 0);
+    qsort(array, n, sizeof(*array), byaddress);
+    for(int i = 0; i < n; i++)
+        fprintf(fs, "0x%03X %s\n", array[i]->address, array[i]->name);
+    fclose(fs);
+}
+
 // Cleans up the binary tree.
 static void burn(struct node* nodes)
 {
@@ -138,19 +152,19 @@ static int add(char* operand, struct node* labels)
     // ADD Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c4\n", a[1], b[1]);
+           emit(0x8004 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     // ADD I, Vx.
     else
     if(strlen(a) == 1 && a[0] == 'I' &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "F%c1E\n", b[1]);
+           emit(0xF01E | nibble(b[1]) << 8, 2);
     // ADD Vx, byte.
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 4 && strncmp(b, "0x", 2) == 0 &&
        isxdigit(b[2]) &&
        isxdigit(b[3]))
-           fprintf(fo, "7%c%c%c\n", a[1], b[2], b[3]);
+           emit(0x7000 | nibble(a[1]) << 8 | nibble(b[2]) << 4 | nibble(b[3]), 2);
     else
         return 1;
     return 0;
@@ -164,7 +178,7 @@ static int _and(char* operand, struct node* labels)
     // AND Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c2\n", a[1], b[1]);
+           emit(0x8002 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     else
         return 1;
     return 0;
@@ -176,7 +190,7 @@ static int call(char* operand, struct node* labels)
     struct node* found = get(labels, a);
     // CALL address.
     if(found)
-        fprintf(fo, "2%03X\n", found->address);
+        emit(0x2000 | found->address, 2);
     else
         return 2;
     return 0;
@@ -186,7 +200,7 @@ static int cls(char* operand, struct node* labels)
 {
     (void )operand, (void) labels;
     // CLS.
-    fprintf(fo, "00E0\n");
+    emit(0x00E0, 2);
     return 0;
 }
 
@@ -198,7 +212,7 @@ static int db(char* operand, struct node* labels)
     if(strlen(a) == 4 && strncmp(a, "0x", 2) == 0 &&
        isxdigit(a[2]) &&
        isxdigit(a[3]))
-           fprintf(fo, "%c%c\n", a[2], a[3]);
+           emit(nibble(a[2]) << 4 | nibble(a[3]), 1);
     else
         return 1;
     return 0;
@@ -214,7 +228,7 @@ static int drw(char* operand, struct node* labels)
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]) &&
        strlen(c) == 3 && strncmp(c, "0x", 2) == 0 && isxdigit(c[2]))
-           fprintf(fo, "D%c%c%c\n", a[1], b[1], c[2]);
+           emit(0xD000 | nibble(a[1]) << 8 | nibble(b[1]) << 4 | nibble(c[2]), 2);
     else
         return 1;
     return 0;
@@ -228,11 +242,11 @@ static int jp(char* operand, struct node* labels)
     // JP V0, address.
     if(strlen(a) == 2 && a[0] == 'V' && a[1] == '0' &&
        (found = get(labels, b)))
-           fprintf(fo, "B%03X\n", found->address);
+           emit(0xB000 | found->address, 2);
     // JP address.
     else
     if((found = get(labels, a)))
-        fprintf(fo, "1%03X\n", found->address);
+        emit(0x1000 | found->address, 2);
     else
         return 2;
     return 0;
@@ -246,60 +260,60 @@ static int ld(char* operand, struct node* labels)
     // LD DT, Vx.
     if(strlen(a) == 2 && a[0] == 'D' && a[1] == 'T' &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "F%c15\n", b[1]);
+           emit(0xF015 | nibble(b[1]) << 8, 2);
     // LD ST, Vx.
     else
     if(strlen(a) == 2 && a[0] == 'S' && a[1] == 'T' &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "F%c18\n", b[1]);
+           emit(0xF018 | nibble(b[1]) << 8, 2);
     // LD F, Vx.
     else
     if(strlen(a) == 1 && a[0] == 'F' &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "F%c29\n", b[1]);
+           emit(0xF029 | nibble(b[1]) << 8, 2);
     // LD B, Vx.
     else
     if(strlen(a) == 1 && a[0] == 'B' &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "F%c33\n", b[1]);
+           emit(0xF033 | nibble(b[1]) << 8, 2);
     // LD Vx, DT.
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'D' && b[1] == 'T')
-           fprintf(fo, "F%c07\n", a[1]);
+           emit(0xF007 | nibble(a[1]) << 8, 2);
     // LD Vx, [I].
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 3 && b[0] == '[' && b[1] == 'I' && b[2] == ']')
-           fprintf(fo, "F%c65\n", a[1]);
+           emit(0xF065 | nibble(a[1]) << 8, 2);
     // LD Vx, K.
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 1 && b[0] == 'K')
-           fprintf(fo, "F%c0A\n", a[1]);
+           emit(0xF00A | nibble(a[1]) << 8, 2);
     // LD Vx, Vy.
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c0\n", a[1], b[1]);
+           emit(0x8000 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     // LD Vx, byte.
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
       (strlen(b) == 4 && strncmp(b, "0x", 2)) == 0 &&
       isxdigit(b[2]) &&
       isxdigit(b[3]))
-           fprintf(fo, "6%c%c%c\n", a[1], b[2], b[3]);
+           emit(0x6000 | nibble(a[1]) << 8 | nibble(b[2]) << 4 | nibble(b[3]), 2);
     // LD [I], Vx.
     else
     if(strlen(a) == 3 && a[0] == '[' && a[1] == 'I' && a[2] == ']' &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "F%c55\n", b[1]);
+           emit(0xF055 | nibble(b[1]) << 8, 2);
     // LD I, address.
     else
     if(strlen(a) == 1 && a[0] == 'I')
     {
        if((found = get(labels, b)))
-           fprintf(fo, "A%03X\n", found->address);
+           emit(0xA000 | found->address, 2);
        else
            return 2;
     }
@@ -316,7 +330,7 @@ static int _or(char* operand, struct node* labels)
     // OR Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c1\n", a[1], b[1]);
+           emit(0x8001 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     else
         return 1;
     return 0;
@@ -326,7 +340,7 @@ static int ret(char* operand, struct node* labels)
 {
     (void) operand, (void) labels;
     // RET.
-    fprintf(fo, "00EE\n");
+    emit(0x00EE, 2);
     return 0;
 }
 
@@ -340,7 +354,7 @@ static int rnd(char* operand, struct node* labels)
        strlen(b) == 4 && strncmp(b, "0x", 2) == 0 &&
        isxdigit(b[2]) &&
        isxdigit(b[3]))
-           fprintf(fo, "C%c%c%c\n", a[1], b[2], b[3]);
+           emit(0xC000 | nibble(a[1]) << 8 | nibble(b[2]) << 4 | nibble(b[3]), 2);
     else
         return 1;
     return 0;
@@ -354,14 +368,14 @@ static int se(char* operand, struct node* labels)
     // SE Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "5%c%c0\n", a[1], b[1]);
+           emit(0x5000 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     // SE Vx, byte.
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 4 && strncmp(b, "0x", 2) == 0 &&
        isxdigit(b[2]) &&
        isxdigit(b[3]))
-           fprintf(fo, "3%c%c%c\n", a[1], b[2], b[3]);
+           emit(0x3000 | nibble(a[1]) << 8 | nibble(b[2]) << 4 | nibble(b[3]), 2);
     else
         return 1;
     return 0;
@@ -375,7 +389,7 @@ static int shl(char* operand, struct node* labels)
     // SHL Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%cE\n", a[1], b[1]);
+           emit(0x800E | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     else
         return 1;
     return 0;
@@ -389,7 +403,7 @@ static int shr(char* operand, struct node* labels)
     // SHR Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c6\n", a[1], b[1]);
+           emit(0x8006 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     else
         return 1;
     return 0;
@@ -401,7 +415,7 @@ static int sknp(char* operand, struct node* labels)
     char* a = strtok(operand, "\t ");
     // SKNP Vx.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]))
-        fprintf(fo, "E%cA1\n", a[1]);
+        emit(0xE0A1 | nibble(a[1]) << 8, 2);
     else
         return 1;
     return 0;
@@ -413,7 +427,7 @@ static int skp(char* operand, struct node* labels)
     char* a = strtok(operand, "\t ");
     // SKP Vx.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]))
-        fprintf(fo, "E%c9E\n", a[1]);
+        emit(0xE09E | nibble(a[1]) << 8, 2);
     else
         return 1;
     return 0;
@@ -427,14 +441,14 @@ static int sne(char* operand, struct node* labels)
     // SNE Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "9%c%c0\n", a[1], b[1]);
+           emit(0x9000 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     // SNE Vx, byte.
     else
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 4 && strncmp(b, "0x", 2) == 0 &&
        isxdigit(b[2]) &&
        isxdigit(b[3]))
-           fprintf(fo, "4%c%c%c\n", a[1], b[2], b[3]);
+           emit(0x4000 | nibble(a[1]) << 8 | nibble(b[2]) << 4 | nibble(b[3]), 2);
     else
         return 1;
     return 0;
@@ -448,7 +462,7 @@ static int sub(char* operand, struct node* labels)
     // SUB Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c5\n", a[1], b[1]);
+           emit(0x8005 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     else
         return 1;
     return 0;
@@ -462,7 +476,22 @@ static int subn(char* operand, struct node* labels)
     // SUBN Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c7\n", a[1], b[1]);
+           emit(0x8007 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
+    else
+        return 1;
+    return 0;
+}
+
+static int sys(char* operand, struct node* labels)
+{
+    (void) labels;
+    char* a = strtok(operand, "\t ");
+    // SYS address.
+    if(strlen(a) == 5 && strncmp(a, "0x", 2) == 0 &&
+       isxdigit(a[2]) &&
+       isxdigit(a[3]) &&
+       isxdigit(a[4]))
+           emit(nibble(a[2]) << 8 | nibble(a[3]) << 4 | nibble(a[4]), 2);
     else
         return 1;
     return 0;
@@ -476,7 +505,7 @@ static int _xor(char* operand, struct node* labels)
     // XOR Vx, Vy.
     if(strlen(a) == 2 && a[0] == 'V' && isxdigit(a[1]) &&
        strlen(b) == 2 && b[0] == 'V' && isxdigit(b[1]))
-           fprintf(fo, "8%c%c3\n", a[1], b[1]);
+           emit(0x8003 | nibble(a[1]) << 8 | nibble(b[1]) << 4, 2);
     else
         return 1;
     return 0;
@@ -484,12 +513,12 @@ static int _xor(char* operand, struct node* labels)
 
 static int (*functions[])(char* operand, struct node* labels) = {
     add, _and, call, cls, db, drw, jp, ld, _or, ret, rnd, se,
-    shl, shr, sknp, skp, sne, sub, subn, _xor
+    shl, shr, sknp, skp, sne, sub, subn, sys, _xor
 };
 
 static const char* mnemonics[] = {
     "ADD","AND","CALL","CLS","DB","DRW","JP","LD","OR","RET","RND","SE",
-    "SHL","SHR","SKNP","SKP","SNE","SUB","SUBN","XOR"
+    "SHL","SHR","SKNP","SKP","SNE","SUB","SUBN","SYS","XOR"
 };
 
 static int compare(const void* a, const void* b)
@@ -510,12 +539,27 @@ static int assemble(char* mnemonic, char* operand, struct node* labels)
     return (*functions[found - mnemonics])(operand, labels);
 }
 
-static struct node* scan(struct node* labels)
+// Copies the next line of the source text, as fgets would from a file.
+// Returns where the line after it starts, or NULL past the end.
+static const char* feed(char* line, const int size, const char* at)
+{
+    if(*at == '\0')
+        return NULL;
+    int i = 0;
+    while(i < size - 1 && *at != '\0')
+        if((line[i++] = *at++) == '\n')
+            break;
+    line[i] = '\0';
+    return at;
+}
+
+static struct node* scan(const char* source, struct node* labels)
 {
     unsigned address = 0x0202;
     const bool growing = labels == NULL;
     char line[320];
-    for(unsigned linenumber = 1; fgets(line, sizeof(line), fi); linenumber++)
+    const char* at = source;
+    for(unsigned linenumber = 1; (at = feed(line, sizeof(line), at)); linenumber++)
     {
         char* label;
         char* mnemonic;
@@ -575,27 +619,80 @@ static void rvec(struct node* labels, const char* entry)
     struct node* reset = get(labels, entry);
     if(!reset)
     {
+        failure = true;
         fprintf(stderr, "error: entry point %s not found\n", entry);
         exit(1);
     }
-    fprintf(fo, "1%03X\n", reset->address);
+    emit(0x1000 | reset->address, 2);
+}
+
+// Assembles source text into the image in two passes over memory.
+// Returns the labels, which the caller burns.
+static struct node* translate(const char* source)
+{
+    // First pass.
+    struct node* labels = scan(source, NULL);
+    // Second pass.
+    written = 0;
+    rvec(labels, "main");
+    scan(source, labels);
+    return labels;
+}
+
+#ifndef LIBRARY
+
+// Name of hex file.
+static char* hexid;
+
+// Cleans up files. Uses failure flag to remove output hex file.
+static void fshutdown()
+{
+    if(dump) fclose(dump);
+    if(failure)
+        remove(hexid);
+}
+
+// Reads a whole file into a null terminated string.
+static char* slurp(const char* path)
+{
+    FILE* const fi = fopen(path, "r");
+    if(fi == NULL)
+    {
+        fprintf(stderr, "error: %s does not exist\n", path);
+        exit(1);
+    }
+    fseek(fi, 0, SEEK_END);
+    const long size = ftell(fi);
+    rewind(fi);
+    char* const text = (char*) malloc(size + 1);
+    text[fread(text, 1, size, fi)] = '\0';
+    fclose(fi);
+    return text;
 }
 
 int main(int argc, char* argv[])
 {
-    if(argc != 3)
+    if(argc != 3 && argc != 4)
     {
-        fprintf(stderr, "expected input and output arguments");
+        fprintf(stderr, "expected input and output arguments, and an optional symbol file");
         exit(1);
     }
-    finit(argv);
-    // First pass.
-    struct node* labels = NULL;
-    labels = scan(labels);
-    frewind();
-    // Second pass.
-    rvec(labels, "main");
-    scan(labels);
+    char* const source = slurp(argv[1]);
+    hexid = argv[2];
+    dump = fopen(hexid, "w");
+    if(dump == NULL)
+    {
+        fprintf(stderr, "error: %s cannot be made\n", hexid);
+        exit(1);
+    }
+    atexit(fshutdown);
+    struct node* labels = translate(source);
+    // Symbols, for mapping addresses back to labels.
+    if(argc == 4)
+        symbols(labels, argv[3]);
     burn(labels);
+    free(source);
     exit(0);
 }
+
+#endif
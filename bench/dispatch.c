@@ -0,0 +1,247 @@
+// The dispatch experiments of wii/ on Linux, driven by the handlers a real ROM executes.
+// Each strategy walks the same stream of handler numbers and reports time, cycles,
+// instructions and branch mispredicts per dispatched handler.
+#define HEADLESS
+#include "../emu.c"
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Not declared at emu.c's POSIX level.
+long syscall(long number, ...);
+
+// Handlers number at most 64, one more marks the end of the stream.
+#define END (64)
+
+#define ROW(M, r) M(r##0) M(r##1) M(r##2) M(r##3) M(r##4) M(r##5) M(r##6) M(r##7) \
+                  M(r##8) M(r##9) M(r##A) M(r##B) M(r##C) M(r##D) M(r##E) M(r##F)
+
+#define EACH(M) ROW(M, 0x0) ROW(M, 0x1) ROW(M, 0x2) ROW(M, 0x3)
+
+// As the wii guard(), a distinct empty asm keeps the compiler from merging handlers,
+// so only dispatch is measured. It also threads 'acc' through so the loop is kept.
+#define WORK(n) __asm__ __volatile__("# " #n : "+r" (acc))
+
+static uint32_t acc;
+
+static uint8_t* stream;
+
+// Handler numbers are the predecoded flat[] indices of the instructions the ROM ran.
+static long trace(const char* rom, const long n)
+{
+    database = NULL;
+    paced = true;
+    seed = 1;
+    load(rom);
+    stream = (uint8_t*) malloc(n + 1);
+    for(long i = 0; i < n; i++)
+    {
+        if(i % 1000 == 0)
+            keys = rnd() << 8 | rnd();
+        stream[i] = decode((mem[pc] << 8) + mem[pc + 1]);
+        cycle();
+        if(i % ipf == 0)
+            timers();
+    }
+    stream[n] = END;
+    return n;
+}
+
+#define CASE(n) case n: WORK(n); break;
+
+static void switched()
+{
+    for(const uint8_t* ip = stream;;)
+        switch(*ip++)
+        {
+        EACH(CASE)
+        case END:
+            return;
+        }
+}
+
+#define CALL(n) static void call##n() { WORK(n); }
+
+EACH(CALL)
+
+#define POINT(n) call##n,
+
+static void (*calls[])() = { EACH(POINT) };
+
+static void called()
+{
+    for(const uint8_t* ip = stream; *ip != END; ip++)
+        (*calls[*ip])();
+}
+
+// Every handler ends in its own copy of the switch, giving each its own indirect branch.
+#define JUMP(n) case n: goto replica##n;
+
+#define JUMPS(r) JUMP(r##0) JUMP(r##1) JUMP(r##2) JUMP(r##3) JUMP(r##4) JUMP(r##5) JUMP(r##6) JUMP(r##7) \
+                 JUMP(r##8) JUMP(r##9) JUMP(r##A) JUMP(r##B) JUMP(r##C) JUMP(r##D) JUMP(r##E) JUMP(r##F)
+
+#define NEXT switch(*ip++) { JUMPS(0x0) JUMPS(0x1) JUMPS(0x2) JUMPS(0x3) case END: return; }
+
+#define REPLICA(n) replica##n: WORK(n); NEXT
+
+static void replicated()
+{
+    const uint8_t* ip = stream;
+    NEXT
+    EACH(REPLICA)
+}
+
+#define LABEL(n) &&label##n,
+
+#define THREAD(n) label##n: WORK(n); goto *labels[*ip++];
+
+static void threaded()
+{
+    static const void* labels[] = { EACH(LABEL) &&done };
+    const uint8_t* ip = stream;
+    goto *labels[*ip++];
+    EACH(THREAD)
+done:
+    return;
+}
+
+// Subroutine threading compiles the stream into a call per handler. The calls are
+// emitted as x86-64 machine code, so other hosts skip it.
+static void (*subroutines)();
+
+static void compile(const long n)
+{
+#if defined(__x86_64__)
+    const size_t size = 4 + 5 * n + 5;
+    // Direct calls reach 2 GB, so the code is asked for just past the handlers.
+    const uintptr_t near = ((uintptr_t) calls[0] & ~(uintptr_t) 0xFFFF) + (64 << 20);
+    const int fd = open("/dev/zero", O_RDWR);
+    uint8_t* const code = (uint8_t*) mmap((void*) near, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(code == MAP_FAILED)
+        return;
+    const intptr_t reach = (intptr_t) code - (intptr_t) calls[0];
+    if(reach > (1l << 30) || reach < -(1l << 30))
+    {
+        munmap(code, size);
+        return;
+    }
+    uint8_t* at = code;
+    // sub rsp, 8 keeps the stack 16 byte aligned at each call.
+    const uint8_t enter[] = { 0x48, 0x83, 0xEC, 0x08 };
+    memcpy(at, enter, sizeof(enter));
+    at += sizeof(enter);
+    for(long i = 0; i < n; i++)
+    {
+        const int32_t to = (int32_t) ((intptr_t) calls[stream[i]] - (intptr_t) (at + 5));
+        *at++ = 0xE8;
+        memcpy(at, &to, sizeof(to));
+        at += sizeof(to);
+    }
+    // add rsp, 8; ret
+    const uint8_t leave[] = { 0x48, 0x83, 0xC4, 0x08, 0xC3 };
+    memcpy(at, leave, sizeof(leave));
+    void* const entry = code;
+    if(mprotect(code, size, PROT_READ | PROT_EXEC) == 0)
+        memcpy(&subroutines, &entry, sizeof(subroutines));
+#else
+    (void) n;
+#endif
+}
+
+static void subroutined()
+{
+    (*subroutines)();
+}
+
+// Cycles, instructions and branch mispredicts in user space, read as one group.
+static int counters = -1;
+
+static int counter(const uint64_t config, const int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void open_counters()
+{
+    counters = counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if(counters == -1)
+        return;
+    if(counter(PERF_COUNT_HW_INSTRUCTIONS, counters) == -1
+    || counter(PERF_COUNT_HW_BRANCH_MISSES, counters) == -1)
+    {
+        close(counters);
+        counters = -1;
+    }
+}
+
+static double clock_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void measure(const char* name, void (*run)(), const long n, const int passes)
+{
+    if(run == subroutined && subroutines == NULL)
+    {
+        printf("%s - - - -\n", name);
+        return;
+    }
+    (*run)();
+    if(counters != -1)
+    {
+        ioctl(counters, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(counters, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    const double t0 = clock_ns();
+    for(int p = 0; p < passes; p++)
+        (*run)();
+    const double t1 = clock_ns();
+    const double ops = (double) n * passes;
+    printf("%s %.2f", name, (t1 - t0) / ops);
+    uint64_t values[4];
+    if(counters != -1)
+    {
+        ioctl(counters, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if(read(counters, values, sizeof(values)) == sizeof(values))
+        {
+            printf(" %.2f %.2f %.3f\n", values[1] / ops, values[2] / ops, values[3] / ops);
+            return;
+        }
+    }
+    printf(" - - -\n");
+}
+
+// Prints one line per strategy: name, ns/op, cycles/op, instructions/op, mispredicts/op.
+// Counters read '-' where perf events are not permitted.
+int main(int argc, char* argv[])
+{
+    if(argc != 4)
+    {
+        fprintf(stderr, "expected rom, instructions to trace and passes arguments\n");
+        exit(1);
+    }
+    const long n = trace(argv[1], atol(argv[2]));
+    const int passes = atoi(argv[3]);
+    compile(n);
+    open_counters();
+    printf("# strategy ns/op cycles/op instructions/op mispredicts/op\n");
+    measure("switch", switched, n, passes);
+    measure("call", called, n, passes);
+    measure("replicated", replicated, n, passes);
+    measure("subroutine", subroutined, n, passes);
+    measure("goto", threaded, n, passes);
+    free(stream);
+}
@@ -0,0 +1,155 @@
+// Times every instruction handler of emu.c on randomized operands.
+#define HEADLESS
+#include "../emu.c"
+
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TSC() __rdtsc()
+#else
+#define TSC() 0
+#endif
+
+#define RUNS (1024)
+
+static const struct handler
+{
+    const char* name;
+    void (*run)();
+    // Operand bits of the opcode that are randomized.
+    uint16_t opcode;
+    uint16_t operands;
+    // Registers are kept to 0-15 for handlers that draw, as sprites are not clipped.
+    bool small;
+}
+handlers[] = {
+    { "_0000", _0000, 0x0000, 0x0FFF, false },
+    { "_00E0", _00E0, 0x00E0, 0x0000, false },
+    { "_00EE", _00EE, 0x00EE, 0x0000, false },
+    { "_1NNN", _1NNN, 0x1000, 0x0FFF, false },
+    { "_2NNN", _2NNN, 0x2000, 0x0FFF, false },
+    { "_3XNN", _3XNN, 0x3000, 0x0FFF, false },
+    { "_4XNN", _4XNN, 0x4000, 0x0FFF, false },
+    { "_5XY0", _5XY0, 0x5000, 0x0FF0, false },
+    { "_6XNN", _6XNN, 0x6000, 0x0FFF, false },
+    { "_7XNN", _7XNN, 0x7000, 0x0FFF, false },
+    { "_8XY0", _8XY0, 0x8000, 0x0FF0, false },
+    { "_8XY1", _8XY1, 0x8001, 0x0FF0, false },
+    { "_8XY2", _8XY2, 0x8002, 0x0FF0, false },
+    { "_8XY3", _8XY3, 0x8003, 0x0FF0, false },
+    { "_8XY4", _8XY4, 0x8004, 0x0FF0, false },
+    { "_8XY5", _8XY5, 0x8005, 0x0FF0, false },
+    { "_8XY6", _8XY6, 0x8006, 0x0FF0, false },
+    { "_8XY7", _8XY7, 0x8007, 0x0FF0, false },
+    { "_8XYE", _8XYE, 0x800E, 0x0FF0, false },
+    { "_9XY0", _9XY0, 0x9000, 0x0FF0, false },
+    { "_ANNN", _ANNN, 0xA000, 0x0FFF, false },
+    { "_BNNN", _BNNN, 0xB000, 0x0FFF, false },
+    { "_CXNN", _CXNN, 0xC000, 0x0FFF, false },
+    { "_DXYN", _DXYN, 0xD000, 0x0FFF, true },
+    { "_EX9E", _EX9E, 0xE09E, 0x0F00, false },
+    { "_EXA1", _EXA1, 0xE0A1, 0x0F00, false },
+    { "_FX07", _FX07, 0xF007, 0x0F00, false },
+    { "_FX0A", _FX0A, 0xF00A, 0x0F00, false },
+    { "_FX15", _FX15, 0xF015, 0x0F00, false },
+    { "_FX18", _FX18, 0xF018, 0x0F00, false },
+    { "_FX1E", _FX1E, 0xF01E, 0x0F00, false },
+    { "_FX29", _FX29, 0xF029, 0x0F00, false },
+    { "_FX33", _FX33, 0xF033, 0x0F00, false },
+    { "_FX55", _FX55, 0xF055, 0x0F00, false },
+    { "_FX65", _FX65, 0xF065, 0x0F00, false },
+    { "_8XY1q", _8XY1q, 0x8001, 0x0FF0, false },
+    { "_8XY2q", _8XY2q, 0x8002, 0x0FF0, false },
+    { "_8XY3q", _8XY3q, 0x8003, 0x0FF0, false },
+    { "_8XY6q", _8XY6q, 0x8006, 0x0FF0, false },
+    { "_8XYEq", _8XYEq, 0x800E, 0x0FF0, false },
+    { "_BXNNq", _BXNNq, 0xB000, 0x0FFF, false },
+    { "_FX55q", _FX55q, 0xF055, 0x0F00, false },
+    { "_FX65q", _FX65q, 0xF065, 0x0F00, false },
+    { "_0101", _0101, 0x0101, 0x0000, false },
+    { "_0102", _0102, 0x0102, 0x0000, false },
+    { "_0103", _0103, 0x0103, 0x0000, false },
+    { "_0104", _0104, 0x0104, 0x0000, false },
+    { "_0105", _0105, 0x0105, 0x0000, true },
+    { "_0106", _0106, 0x0106, 0x0000, true },
+};
+
+static uint16_t ops[RUNS];
+
+// I is kept low enough that a sprite or register dump stays inside RAM.
+static uint16_t is[RUNS];
+
+static double clock_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// Returns the mean and standard deviation of the samples.
+static void spread(const double* const samples, const int n, double* const mean, double* const deviation)
+{
+    double sum = 0.0;
+    for(int i = 0; i < n; i++)
+        sum += samples[i];
+    *mean = sum / n;
+    double squares = 0.0;
+    for(int i = 0; i < n; i++)
+        squares += (samples[i] - *mean) * (samples[i] - *mean);
+    *deviation = sqrt(squares / n);
+}
+
+// Prints one line per handler: name, ns/op mean and deviation, TSC cycles/op mean and deviation.
+int main(int argc, char* argv[])
+{
+    const int repeats = argc > 1 ? atoi(argv[1]) : 50;
+    if(repeats < 2)
+    {
+        fprintf(stderr, "error: expected two or more repeats\n");
+        exit(1);
+    }
+    double* const nss = (double*) malloc(repeats * sizeof(*nss));
+    double* const tscs = (double*) malloc(repeats * sizeof(*tscs));
+    seed = 1;
+    for(int i = 0; i < BYTES; i++)
+        mem[i] = rnd();
+    printf("# handler ns/op ns/op-deviation cycles/op cycles/op-deviation\n");
+    for(unsigned h = 0; h < sizeof(handlers) / sizeof(*handlers); h++)
+    {
+        const struct handler* const at = &handlers[h];
+        for(int i = 0; i < RUNS; i++)
+        {
+            ops[i] = at->opcode | ((rnd() << 8 | rnd()) & at->operands);
+            is[i] = (rnd() << 8 | rnd()) % 0x0E00;
+        }
+        // The first repeat warms caches and is not counted.
+        for(int r = -1; r < repeats; r++)
+        {
+            for(int i = 0; i < VSIZE; i++)
+                v[i] = at->small ? rnd() & 0x0F : rnd();
+            keys = rnd();
+            const double t0 = clock_ns();
+            const uint64_t c0 = TSC();
+            for(int i = 0; i < RUNS; i++)
+            {
+                op = ops[i];
+                I = is[i];
+                sp = 1;
+                (*at->run)();
+            }
+            const uint64_t c1 = TSC();
+            const double t1 = clock_ns();
+            if(r >= 0)
+            {
+                nss[r] = (t1 - t0) / RUNS;
+                tscs[r] = (double) (c1 - c0) / RUNS;
+            }
+        }
+        double ns, nsd, tsc, tscd;
+        spread(nss, repeats, &ns, &nsd);
+        spread(tscs, repeats, &tsc, &tscd);
+        printf("%s %.2f %.2f %.1f %.1f\n", at->name, ns, nsd, tsc, tscd);
+    }
+    free(tscs);
+    free(nss);
+}
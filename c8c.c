@@ -4,6 +4,10 @@
 //  \____) \___/  \____)
 //
 // C8C is a highly portable C-like compiler for the chip8 platform.
+//
+// Each function is parsed into three address code over virtual registers.
+// Optimization passes rewrite it, then the back end lowers it to chip8 assembly,
+// which is assembled in memory.
 
 #include <string.h>
 #include <stdlib.h>
@@ -13,16 +17,98 @@
 #include <ctype.h>
 #include <stdbool.h>
 
-static char* term();
+// The assembler, which assembles the output in memory.
+#define LIBRARY
+#include "asm.c"
+
+// No virtual register.
+#define NONE (-1)
 
-static void expression(char* overrider, const bool shortable);
+static char* term(int* t);
+
+static int expression(char* overrider, const int given, const bool shortable);
 
 static void dblock();
 
-// Variable names.
+// Three address code. Unless noted, a = b op c, where c is the constant k if imm is set.
+enum
+{
+    NOP,
+    // a = k.
+    CONST,
+    // a = b.
+    MOVE,
+    // a = op b.
+    NEG, INV, NOT, BOOL,
+    // a = b op c.
+    ADD, SUB, AND, OR, XOR, MUL, DIV, MOD, SHL, SHR, EQ, NE, LT, LE, GT, GE,
+    // Label k, and branches to it: always, if b is zero, if b is not zero.
+    LABEL, JUMP, JZ, JNZ,
+    // a = labels[k](args).
+    CALL,
+    // a = collision, drawing sprite labels[k] at b, c. Row d of a sprite array if set.
+    DRAW,
+    // a = random byte.
+    RAND,
+    CLEAR,
+    // Returns b if set.
+    RET,
+    // a = spill slot k, and spill slot k = b.
+    LOAD, STORE,
+    // Returns labels[k](args), jumping to it.
+    TAIL,
+};
+
+// Operators, for listings.
+static const char* signs[] = {
+    "", "", "", "-", "~", "!", "!!", "+", "-", "&", "|", "^", "*", "/", "%", "<<", ">>",
+    "==", "!=", "<", "<=", ">", ">="
+};
+
+struct ins
+{
+    int code;
+    int a;
+    int b;
+    int c;
+    int d;
+    int k;
+    bool imm;
+    // Call arguments.
+    int n;
+    int args[14];
+    // Registers live across a call, as a bit mask.
+    int live;
+    // Source line.
+    int line;
+};
+
+struct function
+{
+    struct ins* code;
+    int n;
+    int cap;
+    int params;
+    // Virtual registers, and the chip8 register each is given.
+    int vregs;
+    int room;
+    int* regs;
+    // Bytes spilled to RAM.
+    int spills;
+    // Registers it and its callees write, as a bit mask.
+    int clobbers;
+};
+
+// The function being parsed.
+static struct function* fn;
+
+// Variable names, and the virtual registers holding them.
+// v also counts the values an expression holds on to.
 static int v;
 
-static char* vars[16];
+static char* vars[256];
+
+static int slots[256];
 
 // Array names and function names.
 static int l;
@@ -32,12 +118,35 @@ static struct label
     char* name;
     int args;
     int height;
+    // A function's code, or a sprite's args * height bytes.
+    struct function* function;
+    uint8_t* bytes;
+    int line;
+    // Reached from main, and so emitted.
+    bool used;
 }
 labels[128];
 
 // Counter for branches.
 static int branch;
 
+// Labels of a branch. Label k is kind k % MARKS of branch k / MARKS.
+enum { WHILE, END, ELSE, MARKS };
+
+static const char* marks[] = { "WHILE", "END", "ELSE" };
+
+static int mark(const int b, const int kind)
+{
+    return b * MARKS + kind;
+}
+
+// Source lines, echoed into the assembly as comments.
+static char** sources;
+
+static int nsources;
+
+static int echoed;
+
 // The current input file character.
 static int now;
 
@@ -50,29 +159,67 @@ static const int lmax = 512;
 // Input file (c8).
 static FILE* fi;
 
-// Output file (asm).
-static FILE* fo;
-
 // Input file name.
-static char* c8src;
+static const char* c8src;
+
+// Output file name (bin), removed if bomb() raises the assembler's failure flag.
+static char* rom;
+
+// Optional debug dumps beside each output file: assembly (-a), hex (-x) and labels (-s).
+static bool listing;
+
+static bool hexing;
 
-// Output file name.
-static char* assem;
+static bool labeling;
+
+// Three address code listing beside each output file (-i).
+static bool irlisting;
+
+// Peephole pass over the generated assembly, off with -O0 or -n peephole.
+static bool peeping = true;
+
+// Leaving out what main does not reach, off with -O0 or -n prune.
+static bool pruning = true;
+
+// Instruction counts and sizes before and after the peephole pass (-r).
+static bool reporting;
+
+// Hex dump file name.
+static char* hexid;
 
 // Line buffer.
 static char* line;
 
-// Failure signaler raised by bomb(). Used to remove .c8 file at cleanup.
-static bool failure;
+// Characters buffered on the current line.
+static int reads;
+
+// Output assembly text, kept in memory for the assembler.
+static char* text;
+
+static int length;
+
+static int capacity;
 
-// Writes to the output file. A new line is included.
+// Appends to the output assembly text. A new line is included.
 static void print(const char* msg, ...)
 {
-    va_list args;
-    va_start(args, msg);
-    vfprintf(fo, msg, args);
-    fprintf(fo, "\n");
-    va_end(args);
+    for(;;)
+    {
+        va_list args;
+        va_start(args, msg);
+        const int room = capacity - length;
+        const int n = vsnprintf(text + length, room, msg, args);
+        va_end(args);
+        if(n + 1 < room)
+        {
+            text[length + n] = '\n';
+            length += n + 1;
+            text[length] = '\0';
+            return;
+        }
+        capacity = 2 * capacity + n + 2;
+        text = (char*) realloc(text, capacity);
+    }
 }
 
 // Writes to standard error. A newline is included.
@@ -80,7 +227,7 @@ static void bomb(const char* msg, ...)
 {
     va_list args;
     va_start(args, msg);
-    fprintf(stderr, "error: line %d: ", nline);
+    fprintf(stderr, "error: %s: line %d: ", c8src, nline);
     vfprintf(stderr, msg, args);
     fprintf(stderr, "\n");
     va_end(args);
@@ -91,7 +238,6 @@ static void bomb(const char* msg, ...)
 // Buffers a new character from the input file.
 static void buffer()
 {
-    static int reads;
     if(reads == lmax - 1)
         bomb("line too long");
     line[reads++] = now == '\n' ? '\0' : now;
@@ -99,7 +245,8 @@ static void buffer()
     {
         nline++;
         reads = 0;
-        print(";%s", line);
+        sources = (char**) realloc(sources, (nsources + 1) * sizeof(*sources));
+        sources[nsources++] = dup(line);
     }
 }
 
@@ -121,28 +268,43 @@ static void reset()
     v = 0;
 }
 
-// Removes all label names.
+// Removes all labels, with their code and bytes, and the source lines.
 static void kill()
 {
     for(int i = 0; i < l; i++)
     {
+        struct function* const f = labels[i].function;
+        if(f)
+        {
+            free(f->code);
+            free(f->regs);
+            free(f);
+        }
+        free(labels[i].bytes);
         free(labels[i].name);
         labels[i].name = NULL;
     }
     l = 0;
+    for(int i = 0; i < nsources; i++)
+        free(sources[i]);
+    free(sources);
+    sources = NULL;
+    nsources = 0;
+    echoed = 0;
 }
 
 // Gets a new charcter from the input file. Ignores (//) style comments.
+// A slash not followed by another is division.
 static void next()
 {
     step();
     if(now == '/')
     {
-        step();
-        if(now != '/')
-            bomb("expected '/'");
-        while(now != '\n')
-            step();
+        const int peek = fgetc(fi);
+        ungetc(peek, fi);
+        if(peek == '/')
+            while(now != '\n' && now != EOF)
+                step();
     }
 }
 
@@ -152,57 +314,57 @@ static void skip()
     while(isspace(now)) next();
 }
 
-// Duplicates a string.
-static char* dup(const char* s)
-{
-    return strcpy((char*) malloc(strlen(s) + 1), s);
-}
-
-// Shuts down everything. Removes assembly file if something went wrong.
+// Shuts down everything. Removes output files if something went wrong.
 static void shutdown()
 {
     reset();
     kill();
     free(line);
+    free(text);
     if(fi) fclose(fi);
-    if(fo) fclose(fo);
+    if(dump) fclose(dump);
     if(failure)
-        remove(assem);
+    {
+        if(rom) remove(rom);
+        if(hexid) remove(hexid);
+    }
+    free(rom);
+    free(hexid);
 }
 
 // Initializes everything.
-static void init(char* argv[])
+static void init()
 {
-    struct label baked[] = {
-        { dup("draw"   ), 3, 0 },
-        { dup("putchar"), 3, 0 },
-        { dup("rand"   ), 0, 0 },
-        { dup("getchar"), 0, 0 },
-        { dup("cls"    ), 0, 0 },
-        { dup("sizeof" ), 1, 0 },
-    };
-    for(unsigned i = 0; i < sizeof(baked) / sizeof(*baked); i++)
-        labels[l++] = baked[i];
-    c8src = argv[1];
-    assem = argv[2];
-    // Input file.
-    fi = fopen(argv[1], "r");
-    if(fi == NULL)
-    {
-        fprintf(stderr, "error: %s does not exist\n", c8src);
-        exit(1);
-    }
-    // Output file.
-    fo = fopen(argv[2], "w");
-    if(fo == NULL)
+    line = (char*) malloc(lmax * sizeof(char));
+    capacity = 4096;
+    text = (char*) malloc(capacity * sizeof(char));
+    atexit(shutdown);
+}
+
+// Returns the input file name with its extension swapped.
+static char* sibling(const char* path, const char* extension)
+{
+    const char* dot = strrchr(path, '.');
+    const char* slash = strrchr(path, '/');
+    const int stem = dot && (!slash || dot > slash) ? dot - path : (int) strlen(path);
+    char* name = (char*) malloc(stem + strlen(extension) + 1);
+    memcpy(name, path, stem);
+    strcpy(name + stem, extension);
+    return name;
+}
+
+// Writes size bytes to a new file.
+static void save(const char* path, const void* data, const size_t size)
+{
+    FILE* const fp = fopen(path, "wb");
+    if(fp == NULL)
     {
-        fprintf(stderr, "error: %s cannot be made\n", assem);
+        failure = true;
+        fprintf(stderr, "error: %s cannot be made\n", path);
         exit(1);
     }
-    line = (char*) malloc(lmax * sizeof(char));
-    next();
-    skip();
-    atexit(shutdown);
+    fwrite(data, 1, size, fp);
+    fclose(fp);
 }
 
 // Returns true if two strings match, else false.
@@ -305,7 +467,7 @@ static char* op()
 // Increments the v register.
 static void incv()
 {
-    if(++v == 0xE) bomb("register stack overflow");
+    if(++v == 256) bomb("expression stack overflow");
 }
 
 // Decrements the v register.
@@ -367,333 +529,168 @@ static uint8_t tobyte(const char* value)
     return strtoul(value, NULL, 0) % 256;
 }
 
-// Generate negation (-).
-static void gneg()
-{
-    print("\tLD VF,0xFF");
-    print("\tXOR V%1X,VF", v);
-    print("\tADD V%1X,0x01", v);
-}
-
-// Generate bitwise inversion (~).
-static void ginv()
-{
-    print("\tLD VF,0xFF");
-    print("\tXOR V%1X,VF", v);
-}
-
-// Generate logical not (!).
-static void gnotl()
-{
-    // Converts a positive number into logical 1.
-    print("\tSE V%1X,0x00", v);
-    print("\tLD V%1X,0x01", v);
-    // Xor the number with logical 1.
-    print("\tLD VF,0x01");
-    print("\tXOR V%1X,VF", v);
-}
-
-// Generate addition (+).
-static void gadd()
-{
-    print("\tADD V%1X,V%1X", v - 1, v);
-}
-
-// Generate subtraction (-).
-static void gsub()
+// Returns a new virtual register.
+static int fresh()
 {
-    print("\tSUB V%1X,V%1X", v - 1, v);
+    struct function* const f = fn;
+    if(f->vregs == f->room)
+    {
+        f->room = f->room ? 2 * f->room : 64;
+        f->regs = (int*) realloc(f->regs, f->room * sizeof(int));
+    }
+    return f->vregs++;
 }
 
-// Generate bitwise and (&).
-static void gand()
+// Appends an instruction with no registers set.
+static struct ins* put(const int code)
 {
-    print("\tAND V%1X,V%1X", v - 1, v);
+    struct function* const f = fn;
+    if(f->n == f->cap)
+    {
+        f->cap = f->cap ? 2 * f->cap : 64;
+        f->code = (struct ins*) realloc(f->code, f->cap * sizeof(*f->code));
+    }
+    struct ins* const in = &f->code[f->n++];
+    memset(in, 0, sizeof(*in));
+    in->code = code;
+    in->a = in->b = in->c = in->d = NONE;
+    in->line = nline;
+    return in;
 }
 
-// Generate bitwise or (|).
-static void gor()
+// Exits if a term or expression gave no value.
+static int need(const int t)
 {
-    print("\tOR V%1X,V%1X", v - 1, v);
+    if(t == NONE)
+        bomb("expected value");
+    return t;
 }
 
-// Generate bitwise xor (^).
-static void gxor()
+// Generate constant load.
+static int gconst(const int a, const int k)
 {
-    print("\tXOR V%1X,V%1X", v - 1, v);
+    struct ins* const in = put(CONST);
+    in->a = a;
+    in->k = k;
+    return a;
 }
 
 // Generate move.
-static void gmove()
-{
-    print("\tLD V%1X,V%1X", v - 1, v);
-}
-
-// Generate not equal to (!=).
-static void gneqlto()
-{
-    print("\tLD VF,0x00");
-    print("\tSE V%1X,V%1X", v - 1, v);
-    print("\tLD VF,0x01");
-    print("\tLD V%1X,VF", v - 1);
-}
-
-// Generate equal to (==).
-static void geqlto()
-{
-    print("\tLD VF,0x01");
-    print("\tSE V%1X,V%1X", v - 1, v);
-    print("\tLD VF,0x00");
-    print("\tLD V%1X,VF", v - 1);
-}
-
-// Generate less than or equal to (<=).
-static void glteqlto()
-{
-    print("\tSUBN V%1X,V%1X", v - 1, v);
-    print("\tLD V%1X,VF", v - 1);
-}
-
-// Generate greater than or equal to (>=).
-static void ggteqlto()
-{
-    print("\tSUB V%1X,V%1X", v - 1, v);
-    print("\tLD V%1X,VF", v - 1);
-}
-
-// Generate less than (<).
-static void glt()
-{
-    ggteqlto();
-    print("\tLD VF,0x01");
-    print("\tXOR V%1X,VF", v - 1);
-}
-
-// Generate greater than (>).
-static void ggt()
-{
-    glteqlto();
-    print("\tLD VF,0x01");
-    print("\tXOR V%1X,VF", v - 1);
-}
-
-// Generate copy.
-static void gcp(char* ta)
-{
-    print("\tLD V%1X,V%1X", var(ta), v - 1);
-}
-
-// Generate equal (=).
-static void geql(char* ta)
-{
-    gmove();
-    gcp(ta);
-}
-
-// Generate add equal (+=).
-static void gaddeql(char* ta)
-{
-    gadd();
-    gcp(ta);
-}
-
-// Generate subtract equal (-=)
-static void gsubeql(char* ta)
-{
-    gsub();
-    gcp(ta);
-}
-
-// Generate xor equal (^=)
-static void gxoreql(char* ta)
-{
-    gxor();
-    gcp(ta);
-}
-
-// Generate and equal (&=)
-static void gandeql(char* ta)
-{
-    gand();
-    gcp(ta);
-}
-
-// Generate or equal (|=)
-static void goreql(char* ta)
+static void gmove(const int a, const int b)
 {
-    gor();
-    gcp(ta);
+    struct ins* const in = put(MOVE);
+    in->a = a;
+    in->b = need(b);
 }
 
-// Generate load name.
-static void glname(char* ta)
+// Generate unary operation.
+static int gunary(const int code, const int b)
 {
-    print("\tLD V%1X,V%1X", v, var(ta));
+    struct ins* const in = put(code);
+    in->b = need(b);
+    in->a = fresh();
+    return in->a;
 }
 
-// Generate load digit.
-static void gldig(char* tb)
+// Generate binary operation.
+static int gbinary(const int code, const int a, const int b, const int c)
 {
-    print("\tLD V%1X,0x%02X", v, tobyte(tb));
+    struct ins* const in = put(code);
+    in->a = a;
+    in->b = need(b);
+    in->c = need(c);
+    return a;
 }
 
-// Generate frame push.
-static void gfpush()
+// Generate label.
+static void glabel(const int k)
 {
-    print("\tLD F,VE");
-    print("\tLD [I],VE");
-    print("\tLD VF,0x03");
-    print("\tADD VE,VF");
+    put(LABEL)->k = k;
 }
 
-// Generate frame pop.
-static void gfpop()
+// Generate branch.
+static void gjump(const int code, const int b, const int k)
 {
-    print("\tLD VF,0x03");
-    print("\tSUB VE,VF");
-    print("\tLD VF,V%1X", v);
-    print("\tLD F,VE");
-    print("\tLD VE,[I]");
-    print("\tRET");
+    struct ins* const in = put(code);
+    in->b = b;
+    in->k = k;
 }
 
 // Unary not.
-static char* notl()
+static char* notl(int* t)
 {
     match('!');
-    char* ta = term();
-    gnotl();
+    int b = NONE;
+    char* ta = term(&b);
+    *t = gunary(NOT, b);
     return ta;
 }
 
 // Unary positive.
-static char* pos()
+static char* pos(int* t)
 {
     match('+');
     if(now == '+')
         bomb("operator '++' not supported");
-    return term();
+    return term(t);
 }
 
 // Unary bitwise invert.
-static char* inv()
+static char* inv(int* t)
 {
     match('~');
-    char* ta = term();
-    ginv();
+    int b = NONE;
+    char* ta = term(&b);
+    *t = gunary(INV, b);
     return ta;
 }
 
 // Unary negate.
-static char* neg()
+static char* neg(int* t)
 {
     match('-');
     if(now == '-')
         bomb("operator '--' not supported");
-    char* ta = term();
-    gneg();
+    int b = NONE;
+    char* ta = term(&b);
+    *t = gunary(NEG, b);
     return ta;
 }
 
 // Force an expression.
-static char* fexp()
+static char* fexp(int* t)
 {
     match('(');
-    expression(NULL, true);
+    *t = expression(NULL, NONE, true);
     match(')');
     return dup(")");
 }
 
 // Load digit.
-static char* ldig()
+static char* ldig(int* t)
 {
     char* tb = dig();
-    gldig(tb);
+    *t = gconst(fresh(), tobyte(tb));
     return tb;
 }
 
-// Saves a copy of this frame then moves this frame to next.
-static void move(const int args)
-{
-    gfpush();
-    for(int i = 0; i < args; i++)
-        print("\tLD V%1X,V%1X", i, v + i);
-}
-
 // Return.
 static void sret()
 {
-    expression(NULL, true);
+    const int t = expression(NULL, NONE, true);
     match(';');
-    gfpop();
-}
-
-// Get character.
-static void getchr()
-{
-    print("getchar:");
-    print("\tLD V0,0xFF"); // Return value.
-    print("\tLD V1,0x00\n\tSKNP V1\n\tLD V0,0x00");
-    print("\tLD V1,0x01\n\tSKNP V1\n\tLD V0,0x01");
-    print("\tLD V1,0x02\n\tSKNP V1\n\tLD V0,0x02");
-    print("\tLD V1,0x03\n\tSKNP V1\n\tLD V0,0x03");
-    print("\tLD V1,0x04\n\tSKNP V1\n\tLD V0,0x04");
-    print("\tLD V1,0x05\n\tSKNP V1\n\tLD V0,0x05");
-    print("\tLD V1,0x06\n\tSKNP V1\n\tLD V0,0x06");
-    print("\tLD V1,0x07\n\tSKNP V1\n\tLD V0,0x07");
-    print("\tLD V1,0x08\n\tSKNP V1\n\tLD V0,0x08");
-    print("\tLD V1,0x09\n\tSKNP V1\n\tLD V0,0x09");
-    print("\tLD V1,0x0A\n\tSKNP V1\n\tLD V0,0x0A");
-    print("\tLD V1,0x0B\n\tSKNP V1\n\tLD V0,0x0B");
-    print("\tLD V1,0x0C\n\tSKNP V1\n\tLD V0,0x0C");
-    print("\tLD V1,0x0D\n\tSKNP V1\n\tLD V0,0x0D");
-    print("\tLD V1,0x0E\n\tSKNP V1\n\tLD V0,0x0E");
-    print("\tLD V1,0x0F\n\tSKNP V1\n\tLD V0,0x0F");
-    // Done, restore return value.
-    gfpop();
-}
-
-// Put charater.
-static void putchr()
-{
-    const int spacing = 1;
-    const int width = 4;
-    print("putchar:");
-    // Shift up: V0, V1, V2 will be populated by I, I+1, I+2.
-    print("\tLD V5,V2"); // N
-    print("\tLD V4,V1"); // Y
-    print("\tLD V3,V0"); // X
-    // V6 will serve as a collision flag.
-    print("\tLD V6,0x00");
-    print("\tLD B,V5");
-    print("\tLD V2,[I]");
-    // First.
-    print("\tLD F,V0");
-    print("\tDRW V3,V4,0x5");
-    print("\tOR V6,VF");
-    // Second.
-    print("\tLD F,V1");
-    print("\tADD V3,0x%02X", width + spacing);
-    print("\tDRW V3,V4,0x5");
-    print("\tOR V6,VF");
-    // Third.
-    print("\tLD F,V2");
-    print("\tADD V3,0x%02X", width + spacing);
-    print("\tDRW V3,V4,0x5");
-    print("\tOR V6,VF");
-    // Done. Restore return value.
-    v = 6;
-    gfpop();
+    gjump(RET, t, 0);
 }
 
 // Draw. Hardcoded inline for performance.
-static void draw()
+static int draw()
 {
     const int args = 2;
+    int at[2];
     // The first two arguments are expressions for x, y.
     for(int i = 0; i < args; i++)
     {
-        expression(NULL, true);
+        at[i] = need(expression(NULL, NONE, true));
         incv();
         match(',');
     }
@@ -703,52 +700,54 @@ static void draw()
     const int index = find(label);
     if(index == -1)
         bomb("label '%s' not defined", label);
-    print("\tLD I,%s", labels[index].name);
+    free(label);
     // Optionally, appending square brackets to the label will index the sprite.
+    int row = NONE;
     skip();
     if(now == '[')
     {
-        const int b = branch++;
         match('[');
-        expression(NULL, true);
+        row = need(expression(NULL, NONE, true));
         match(']');
-        print("WHILE%d:", b);
-        print("\tSNE V%X,0x00", v);
-        print("\tJP OUT%d", b);
-        print("\tLD VF,0x%02X", labels[index].args);
-        print("\tADD I,VF");
-        print("\tLD VF,0x01");
-        print("\tSUB V%X,VF", v);
-        print("\tJP WHILE%d", b);
-        print("OUT%d:", b);
     }
-    print("\tDRW V%1X,V%1X,0x%1X", v - 2, v - 1, labels[index].args);
-    free(label);
     v -= args;
+    struct ins* const in = put(DRAW);
+    in->a = fresh();
+    in->b = at[0];
+    in->c = at[1];
+    in->d = row;
+    in->k = index;
+    return in->a;
 }
 
 // Clear screen. Inlined for performance.
-static void clear()
+static int clear()
 {
-    print("\tCLS");
+    put(CLEAR);
+    return gconst(fresh(), 0x00);
 }
 
 // Random number. Inlined for performance.
-static void rnd()
+static int grnd()
 {
-    print("\tRND VF,0xFF");
+    struct ins* const in = put(RAND);
+    in->a = fresh();
+    return in->a;
 }
 
 // Generate function call.
-static void gfcall(const char* name)
+static int gfcall(const char* name)
 {
     const int i = find(name);
     if(i == -1)
         bomb("function '%s' not defined", name);
+    int at[16];
     int args = 0;
     while(now != ')')
     {
-        expression(NULL, true);
+        if(args == 14)
+            bomb("too many arguments when calling '%s'", name);
+        at[args] = need(expression(NULL, NONE, true));
         incv();
         args++;
         skip();
@@ -762,12 +761,16 @@ static void gfcall(const char* name)
     if(labels[i].args != args)
         bomb("argument mismatch when calling '%s'", name);
     v -= args;
-    move(args);
-    print("\tCALL %s", name);
+    struct ins* const in = put(CALL);
+    in->a = fresh();
+    in->k = i;
+    in->n = args;
+    memcpy(in->args, at, args * sizeof(*at));
+    return in->a;
 }
 
 // Generate size.
-static void szof()
+static int szof()
 {
     char* n = name();
     const int index = find(n);
@@ -779,24 +782,23 @@ static void szof()
     {
         match('[');
         match(']');
-        print("\tLD VF,0x%02X", labels[index].height);
+        return gconst(fresh(), labels[index].height);
     }
-    else
-        print("\tLD VF,0x%02X", labels[index].args);
+    return gconst(fresh(), labels[index].args);
 }
 
 // Function call.
-static void fcall(const char* name)
+static int fcall(const char* name)
 {
     match('(');
     // These built in functions that will inline.
-    eql(name, "draw")    ? draw()   :
-    eql(name, "sizeof")  ? szof()   :
-    eql(name, "rand")    ? rnd()    :
-    eql(name, "clear")   ? clear()  : gfcall(name);
+    const int t =
+        eql(name, "draw")    ? draw()   :
+        eql(name, "sizeof")  ? szof()   :
+        eql(name, "rand")    ? grnd()   :
+        eql(name, "clear")   ? clear()  : gfcall(name);
     match(')');
-    // Load return value.
-    print("\tLD V%1X,VF", v);
+    return t;
 }
 
 // Returns true if the string is a token.
@@ -805,64 +807,103 @@ static bool istoken(char* s)
     return eql(s, "while") || eql(s, "if") || eql(s, "auto") || eql(s, "return");
 }
 
-// Load name.
-static char* lname()
+// Load name. Variables are read straight from their registers.
+static char* lname(int* t)
 {
     char* ta = name();
     if(istoken(ta))
         return ta;
     skip();
-    now == '(' ? fcall(ta) : glname(ta);
+    *t = now == '(' ? fcall(ta) : slots[var(ta)];
     return ta;
 }
 
 // Terms may start with a prefix modifier, an alpha for a name load
 // or a digit for a digit load. A term may be forced into an expression
-// with surrounding round brackets.
-static char* term()
+// with surrounding round brackets. The value of the term is put in t.
+static char* term(int* t)
 {
     skip();
     return
     // Prefix modifiers.
-    now == '~' ? inv  () :
-    now == '+' ? pos  () :
-    now == '!' ? notl () :
-    now == '-' ? neg  () :
+    now == '~' ? inv  (t) :
+    now == '+' ? pos  (t) :
+    now == '!' ? notl (t) :
+    now == '-' ? neg  (t) :
     // Name load.
-    isalpha(now) ? lname() :
+    isalpha(now) ? lname(t) :
     // Digit load.
-    isdigit(now) ? ldig () :
+    isdigit(now) ? ldig (t) :
     // Term is expression (enclosed in brackets).
-    now == '(' ? fexp() : peeks();
+    now == '(' ? fexp(t) : peeks();
     /* Returns the string in all cases, even if nothing was done. */
 }
 
-// Operate.
-// Operators work on chained variables from V0 to VD (inclusive).
-static void operate(char* o, char* t)
-{
-    eql(o, "=" ) ? geql     (t) : // Assignment.
-    eql(o, "+=") ? gaddeql  (t) : // Assignment.
-    eql(o, "-=") ? gsubeql  (t) : // Assignment.
-    eql(o, "^=") ? gxoreql  (t) : // Assignment.
-    eql(o, "&=") ? gandeql  (t) : // Assignment.
-    eql(o, "|=") ? goreql   (t) : // Assignment.
-    eql(o, "+" ) ? gadd     ()  : // Chain.
-    eql(o, "-" ) ? gsub     ()  : // Chain.
-    eql(o, "&" ) ? gand     ()  : // Chain.
-    eql(o, "^" ) ? gxor     ()  : // Chain.
-    eql(o, "|" ) ? gor      ()  : // Chain.
-    eql(o, "<" ) ? glt      ()  : // Comparison.
-    eql(o, "<=") ? glteqlto ()  : // Comparison.
-    eql(o, ">=") ? ggteqlto ()  : // Comparison.
-    eql(o, ">" ) ? ggt      ()  : // Comparison.
-    eql(o, "!=") ? gneqlto  ()  : // Comparison.
-    eql(o, "==") ? geqlto   ()  : // Comparison.
-    eql(o, "||") ? gmove    ()  : // Logical.
-    eql(o, "&&") ? gmove    ()  : // Logical.
-    eql(o, "!" ) ? gnotl    ()  : // Unary.
+// Returns the code of an assignment operator, or NOP.
+static int assigning(const char* o)
+{
+    return
+    eql(o, "=" ) ? MOVE :
+    eql(o, "+=") ? ADD  :
+    eql(o, "-=") ? SUB  :
+    eql(o, "^=") ? XOR  :
+    eql(o, "&=") ? AND  :
+    eql(o, "|=") ? OR   :
+    eql(o, "*=") ? MUL  :
+    eql(o, "/=") ? DIV  :
+    eql(o, "%=") ? MOD  :
+    eql(o, "<<=") ? SHL :
+    eql(o, ">>=") ? SHR : NOP;
+}
+
+// Returns the code of a comparison operator, or NOP.
+static int comparing(const char* o)
+{
+    return
+    eql(o, "<" ) ? LT :
+    eql(o, "<=") ? LE :
+    eql(o, ">=") ? GE :
+    eql(o, ">" ) ? GT :
+    eql(o, "!=") ? NE :
+    eql(o, "==") ? EQ : NOP;
+}
+
+// Returns the code of a chaining operator, or NOP.
+static int chaining(const char* o)
+{
+    return
+    eql(o, "+" ) ? ADD :
+    eql(o, "-" ) ? SUB :
+    eql(o, "&" ) ? AND :
+    eql(o, "^" ) ? XOR :
+    eql(o, "|" ) ? OR  :
+    eql(o, "*" ) ? MUL :
+    eql(o, "/" ) ? DIV :
+    eql(o, "%" ) ? MOD :
+    eql(o, "<<") ? SHL :
+    eql(o, ">>") ? SHR : NOP;
+}
+
+// Operate on a and c, where term ta gave a.
+// Assignments write the variable and give it. Other operators give a new register.
+static int operate(char* o, char* ta, const int a, const int c)
+{
+    const int assigns = assigning(o);
+    if(assigns == MOVE)
+    {
+        const int x = slots[var(ta)];
+        gmove(x, c);
+        return x;
+    }
+    if(assigns != NOP)
+    {
+        const int x = slots[var(ta)];
+        return gbinary(assigns, x, x, c);
+    }
+    const int code = comparing(o) != NOP ? comparing(o) : chaining(o);
+    if(code == NOP)
         bomb("unknown operator '%s'", o);
-    /* Exits if operator is not found. */
+    return gbinary(code, fresh(), a, c);
 }
 
 // Names start with alpha characters or underscores.
@@ -874,14 +915,16 @@ static bool isname(const char* s)
 }
 
 // TA O TB O TA ...
-static void expression(char* overrider, const bool shortable)
+// Returns the register holding the value, or NONE if there was no expression.
+static int expression(char* overrider, const int given, const bool shortable)
 {
     // Assume term is not an L-value.
     bool lvalue = false;
     // Goes high when using logical operators.
     bool shorting = false;
     const int b = branch++;
-    char* ta = overrider ? overrider : term();
+    int a = given;
+    char* ta = overrider ? overrider : term(&a);
     // If term is a name then it is an L-value.
     if(isname(ta))
         lvalue = true;
@@ -893,28 +936,18 @@ static void expression(char* overrider, const bool shortable)
     {
         incv();
         char* o = op();
+        int c = NONE;
         // If the operator is an assignment operator, then
         // a new expression is computed. lvalue is first checked.
-        if(eql(o, "=" )
-        || eql(o, "+=")
-        || eql(o, "-=")
-        || eql(o, "^=")
-        || eql(o, "&=")
-        || eql(o, "|="))
+        if(assigning(o) != NOP)
         {
             if(lvalue == false)
                 bomb("expected lvalue to the left of operator '%s'", o);
-            expression(NULL, true);
+            c = expression(NULL, NONE, true);
         }
         // If the operator is a comparison operator then a new expression is computed.
-        else if(
-           eql(o, "<" )
-        || eql(o, "<=")
-        || eql(o, ">=")
-        || eql(o, ">" )
-        || eql(o, "!=")
-        || eql(o, "=="))
-            expression(NULL, true);
+        else if(comparing(o) != NOP)
+            c = expression(NULL, NONE, true);
         // If the operator is a short circuit operator a new
         // expression is computed. Given this, the expression will turn
         // logical at the end of each subsequent expression.
@@ -923,17 +956,20 @@ static void expression(char* overrider, const bool shortable)
         || eql(o, "&&"))
         {
             shorting = true;
-            print("\t%s V%1X,0x00", eql(o, "||") ? "SE" : "SNE", v - 1);
-            print("\tJP END%d", b);
-            expression(NULL, false);
+            const int r = fresh();
+            gmove(r, a);
+            gjump(eql(o, "||") ? JNZ : JZ, r, mark(b, END));
+            gmove(r, expression(NULL, NONE, false));
+            a = r;
         }
-        char* tb = term();
+        char* tb = term(&c);
         // If this is the second term of the expression, then there is
         // no way that this expression is l-value correct in case a future
         // assignment operator is encountered.
         lvalue = false;
         // Operate on the two terms and let the magic happen.
-        operate(o, ta);
+        if(!shorting)
+            a = operate(o, ta, a, c);
         decv();
         free(o);
         free(ta);
@@ -941,28 +977,27 @@ static void expression(char* overrider, const bool shortable)
     }
     if(shorting)
     {
-        print("END%d:", b);
+        glabel(mark(b, END));
         if(shortable)
-        {
-            print("\tSE V%1X,0x00", v);
-            print("\tLD V%1X,0x01", v);
-        }
+            a = gunary(BOOL, a);
     }
     free(ta);
+    return a;
 }
 
 // Generate array.
-// Returns the number of elements in the array.
-static int garr()
+// Returns the number of elements in the array, which are put in row.
+static int garr(uint8_t* row)
 {
     match('{');
     int size = 0;
     skip();
     while(now != '}')
     {
+        if(size == 0xF)
+            bomb("too many elements in sprite");
         char* d = dig();
-        print("\tDB 0x%02X", tobyte(d));
-        size++;
+        row[size++] = tobyte(d);
         free(d);
         skip();
         // Bytes are separated by commas.
@@ -974,18 +1009,26 @@ static int garr()
             if(now == '}') break;
         }
     }
-    if(size > 0xF)
-        bomb("too many elements in sprite");
     match('}');
     return size;
 }
 
+// Appends a row of sprite bytes to those before it.
+static uint8_t* append(uint8_t* bytes, const int before, const uint8_t* row, const int size)
+{
+    bytes = (uint8_t*) realloc(bytes, before + size + 1);
+    memcpy(bytes + before, row, size);
+    return bytes;
+}
+
 // Declaring an array (sprite).
 static void arr(char* name)
 {
     isndef(name);
-    print("%s:", name);
+    const int at = nline;
     skip();
+    uint8_t row[0xF];
+    uint8_t* bytes = NULL;
     int size = 0;
     int height = 0;
     // Array of sprite arrays.
@@ -997,7 +1040,8 @@ static void arr(char* name)
         match(']');
         match('=');
         match('{');
-        size = garr();
+        size = garr(row);
+        bytes = append(bytes, 0, row, size);
         skip();
         height++;
         while(now == ',')
@@ -1006,8 +1050,9 @@ static void arr(char* name)
             skip();
             if(now == '}')
                 break;
-            if(garr() != size)
+            if(garr(row) != size)
                 bomb("array elements must be same length");
+            bytes = append(bytes, height * size, row, size);
             height++;
             skip();
         }
@@ -1020,10 +1065,11 @@ static void arr(char* name)
     {
         match('=');
         height = 1;
-        size = garr();
+        size = garr(row);
+        bytes = append(bytes, 0, row, size);
     }
     match(';');
-    struct label sprite = { name, size, height };
+    struct label sprite = { name, size, height, NULL, bytes, at, false };
     labels[l++] = sprite;
 }
 
@@ -1036,10 +1082,11 @@ static void dident(int* const idents)
         char* n = name();
         isndef(n);
         vars[v] = n;
+        slots[v] = fresh();
         // Note equal signs are required when creating identifiers.
         // This will prevent uninitialized variables from cropping up.
         match('=');
-        expression(NULL, true);
+        gmove(slots[v], expression(NULL, NONE, true));
         incv();
         *idents += 1;
         // If identifiers are separated by commas, keep going.
@@ -1054,14 +1101,12 @@ static void swhile()
 {
     const int b = branch++;
     match('(');
-    print("WHILE%d:", b);
-    expression(NULL, true);
-    print("\tSNE V%1X,0x00", v);
-    print("\tJP END%d", b);
+    glabel(mark(b, WHILE));
+    gjump(JZ, need(expression(NULL, NONE, true)), mark(b, END));
     match(')');
     dblock();
-    print("\tJP WHILE%d", b);
-    print("END%d:", b);
+    gjump(JUMP, NONE, mark(b, WHILE));
+    glabel(mark(b, END));
 }
 
 // Declaring an if statement.
@@ -1069,13 +1114,11 @@ static void sif()
 {
     const int b = branch++;
     match('(');
-    expression(NULL, true);
-    print("\tSNE V%1X,0x00", v);
-    print("\tJP ELSE%d", b);
+    gjump(JZ, need(expression(NULL, NONE, true)), mark(b, ELSE));
     match(')');
     dblock();
-    print("\tJP END%d", b);
-    print("ELSE%d:", b);
+    gjump(JUMP, NONE, mark(b, END));
+    glabel(mark(b, ELSE));
     skip();
     // The else statement.
     if(now == 'e')
@@ -1096,7 +1139,7 @@ static void sif()
         }
         else dblock();
     }
-    print("END%d:", b);
+    glabel(mark(b, END));
 }
 
 // Declaring a block.
@@ -1108,12 +1151,13 @@ static void dblock()
     skip();
     while(now != '}')
     {
-        char* ta = term();
+        int t = NONE;
+        char* ta = term(&t);
         eql(ta, "{")      ? (free(ta), dblock ()       ) :
         eql(ta, "while")  ? (free(ta), swhile ()       ) :
         eql(ta, "if")     ? (free(ta), sif    ()       ) :
         eql(ta, "auto")   ? (free(ta), dident (&idents)) :
-        eql(ta, "return") ? (free(ta), sret   ()       ) : (expression(ta, true), match(';'));
+        eql(ta, "return") ? (free(ta), sret   ()       ) : (expression(ta, t, true), match(';'));
         /* An expression is computed as a last restort. */
         skip();
     }
@@ -1125,6 +1169,7 @@ static void dblock()
 static void fun(char* n)
 {
     isndef(n);
+    fn = (struct function*) calloc(1, sizeof(*fn));
     match('(');
     skip();
     int args = 0;
@@ -1137,70 +1182,2310 @@ static void fun(char* n)
         // If its a closing paren then there are no more args.
         if(now == ',' || now == ')')
         {
+            if(args == 14)
+                bomb("too many arguments");
             if(now == ',') match(',');
             vars[v] = arg;
+            // Arguments are the first virtual registers.
+            slots[v] = fresh();
             incv();
             args++;
         }
         else bomb("unknown symbol in argument list");
         skip();
     }
+    fn->params = args;
     // Labels contain a 'height' field. This only pertains
     // to a collection of sprite arrays for a label.
-    struct label label = { n, args, 0 };
+    struct label label = { n, args, 0, fn, NULL, nline, false };
     labels[l++] = label;
-    print("%s:", n);
     match(')');
-    // VE must start here for stack space to avoid
-    // trampling over the built in font array.
-    if(eql(n, "main"))
-        print("\tLD VE,0x10");
     dblock();
-    // Note the popping here occurs after the block statement. The block statement
-    // clears up any internal identifiers, so fpop will return V0 into VF.
-    gfpop();
+    // Falling off the end returns nothing in particular.
+    gjump(RET, NONE, 0);
     reset();
 }
 
-void stdio()
+// Removes instructions turned into no-ops.
+static void compact(struct function* f)
 {
-    print(";stdio: Standard Input and Output library");
-    getchr();
-    putchr();
+    int n = 0;
+    for(int i = 0; i < f->n; i++)
+        if(f->code[i].code != NOP)
+            f->code[n++] = f->code[i];
+    f->n = n;
 }
 
-// Declaring a program.
-// Programs are defined by functions and spirte arrays.
-static void program()
+// Returns true if an instruction does nothing but compute its result.
+static bool pure(const int code)
 {
-    while(now != EOF)
+    return code >= CONST && code <= GE;
+}
+
+// Returns true if an instruction branches.
+static bool isbranch(const int code)
+{
+    return code == JUMP || code == JZ || code == JNZ;
+}
+
+// Counts the reads of each virtual register.
+static int* uses(const struct function* f)
+{
+    int* const count = (int*) calloc(f->vregs, sizeof(int));
+    for(int i = 0; i < f->n; i++)
     {
-        char* n = name();
-        skip();
-        switch(now)
-        {
-        case '[':
-        case '=':
-            arr(n);
-            break;
-        case '(':
-            fun(n);
-            break;
-        default:
-            bomb("symbol '%c' not known", now);
-            break;
-        }
-        skip();
+        const struct ins* const in = &f->code[i];
+        if(in->b != NONE) count[in->b]++;
+        if(in->c != NONE) count[in->c]++;
+        if(in->d != NONE) count[in->d]++;
+        for(int j = 0; j < in->n; j++)
+            count[in->args[j]]++;
     }
-    // Libraries to link at compile time.
-    stdio();
+    return count;
 }
 
-// Rock and Roll, baby.
-int main(int argc, char* argv[])
+// Returns where label k is.
+static int where(const struct function* f, const int k)
 {
-    if(argc != 3)
-        bomb("expected input and output file");
-    init(argv);
-    program();
+    for(int i = 0; i < f->n; i++)
+        if(f->code[i].code == LABEL && f->code[i].k == k)
+            return i;
+    return f->n;
+}
+
+// Returns op applied to the bytes b and c.
+static int compute(const int code, const int b, const int c)
+{
+    switch(code)
+    {
+    case NEG: return -b & 0xFF;
+    case INV: return ~b & 0xFF;
+    case NOT: return b == 0;
+    case BOOL: return b != 0;
+    case ADD: return (b + c) & 0xFF;
+    case SUB: return (b - c) & 0xFF;
+    case AND: return b & c;
+    case OR: return b | c;
+    case XOR: return b ^ c;
+    case MUL: return (b * c) & 0xFF;
+    // Division by zero gives what the runtime routine does.
+    case DIV: return c == 0 ? 0xFF : b / c;
+    case MOD: return c == 0 ? b : b % c;
+    case SHL: return c > 7 ? 0 : (b << c) & 0xFF;
+    case SHR: return c > 7 ? 0 : b >> c;
+    case EQ: return b == c;
+    case NE: return b != c;
+    case LT: return b < c;
+    case LE: return b <= c;
+    case GT: return b > c;
+    case GE: return b >= c;
+    }
+    return 0;
+}
+
+// Returns the operation giving b op c with its operands swapped.
+static int mirror(const int code)
+{
+    return code == LT ? GT : code == GT ? LT : code == LE ? GE : code == GE ? LE : code;
+}
+
+// Returns true if b op c can be given as c op b, after mirroring.
+static bool swaps(const int code)
+{
+    return code != SUB && code != DIV && code != MOD && code != SHL && code != SHR;
+}
+
+// Returns the constant each virtual register holds, or NONE. Registers written
+// once by a constant load, such as autos never assigned again, always hold it.
+static int* constants(const struct function* f)
+{
+    int* const writes = (int*) calloc(f->vregs, sizeof(int));
+    int* const known = (int*) malloc(f->vregs * sizeof(int));
+    for(int t = 0; t < f->vregs; t++)
+        known[t] = NONE;
+    for(int t = 0; t < f->params; t++)
+        writes[t]++;
+    for(int i = 0; i < f->n; i++)
+        if(f->code[i].a != NONE)
+            writes[f->code[i].a]++;
+    for(int i = 0; i < f->n; i++)
+        if(f->code[i].code == CONST && writes[f->code[i].a] == 1)
+            known[f->code[i].a] = f->code[i].k;
+    free(writes);
+    return known;
+}
+
+// Pass: operations on constants become constants, constant operands become immediates,
+// and branches on constants are always or never taken.
+static bool fold(struct function* f)
+{
+    int* const known = constants(f);
+    bool changed = false;
+    for(int i = 0; i < f->n; i++)
+    {
+        struct ins* const in = &f->code[i];
+        const int b = in->b == NONE ? NONE : known[in->b];
+        const int c = in->imm ? in->k : in->c == NONE ? NONE : known[in->c];
+        const int was = changed;
+        changed = true;
+        if(in->code >= MOVE && in->code <= BOOL && b != NONE)
+        {
+            in->k = in->code == MOVE ? b : compute(in->code, b, 0);
+            in->code = CONST;
+            in->b = NONE;
+        }
+        else
+        if(in->code >= ADD && in->code <= GE && b != NONE && c != NONE)
+        {
+            in->k = compute(in->code, b, c);
+            in->code = CONST;
+            in->b = in->c = NONE;
+            in->imm = false;
+        }
+        else
+        if(in->code >= ADD && in->code <= GE && c != NONE && !in->imm)
+        {
+            in->imm = true;
+            in->k = c;
+            in->c = NONE;
+        }
+        else
+        if(in->code >= ADD && in->code <= GE && b != NONE && !in->imm && swaps(in->code))
+        {
+            in->imm = true;
+            in->k = b;
+            in->b = in->c;
+            in->c = NONE;
+            in->code = mirror(in->code);
+        }
+        else
+        if(in->imm && in->k == 0 && (in->code == ADD || in->code == SUB || in->code == OR || in->code == XOR
+        || in->code == SHL || in->code == SHR))
+        {
+            in->code = MOVE;
+            in->imm = false;
+        }
+        else
+        if(in->imm && in->k == 1 && (in->code == MUL || in->code == DIV))
+        {
+            in->code = MOVE;
+            in->imm = false;
+        }
+        else
+        if((in->code == JZ || in->code == JNZ) && b != NONE)
+        {
+            in->code = (in->code == JZ) == (b == 0) ? JUMP : NOP;
+            in->b = NONE;
+        }
+        else
+            changed = was;
+    }
+    free(known);
+    compact(f);
+    return changed;
+}
+
+// Returns n if k is two to the n, else NONE.
+static int power(const int k)
+{
+    for(int n = 0; n < 8; n++)
+        if(k == 1 << n)
+            return n;
+    return NONE;
+}
+
+// Appends a = b op k.
+static int gimm(const int code, const int a, const int b, const int k, const int source)
+{
+    struct ins* const in = put(code);
+    in->a = a;
+    in->b = b;
+    in->k = k;
+    in->imm = true;
+    in->line = source;
+    return a;
+}
+
+// Appends a = b * k as shifts and adds, one add for each set bit of k below its top.
+static void gproduct(const struct ins* at)
+{
+    int top = 7;
+    while(!(at->k >> top & 1))
+        top--;
+    int t = at->b;
+    int shifts = 0;
+    for(int bit = top - 1; bit >= 0; bit--)
+    {
+        shifts++;
+        if(at->k >> bit & 1)
+        {
+            t = gimm(SHL, fresh(), t, shifts, at->line);
+            struct ins* const in = put(ADD);
+            in->a = fresh();
+            in->b = t;
+            in->c = at->b;
+            in->line = at->line;
+            t = in->a;
+            shifts = 0;
+        }
+    }
+    if(shifts > 0)
+        t = gimm(SHL, fresh(), t, shifts, at->line);
+    struct ins* const in = put(MOVE);
+    in->a = at->a;
+    in->b = t;
+    in->line = at->line;
+}
+
+// Returns true if the pass below rewrites an instruction.
+static bool reducible(const struct ins* in)
+{
+    return in->imm && (in->code == MUL
+        || ((in->code == DIV || in->code == MOD) && power(in->k) != NONE)
+        || ((in->code == SHL || in->code == SHR) && in->k > 7));
+}
+
+// Pass: products with constants become shifts and adds, quotients and remainders
+// by powers of two become shifts and masks, and shifts past the byte give zero.
+static bool reduce(struct function* f)
+{
+    bool changed = false;
+    for(int i = 0; i < f->n; i++)
+        changed |= reducible(&f->code[i]);
+    if(!changed)
+        return false;
+    struct ins* const code = f->code;
+    const int n = f->n;
+    f->code = NULL;
+    f->n = f->cap = 0;
+    fn = f;
+    for(int i = 0; i < n; i++)
+    {
+        struct ins at = code[i];
+        if(!reducible(&at))
+            *put(NOP) = at;
+        else
+        if(at.code == MUL && at.k > 0)
+            gproduct(&at);
+        else
+        if(at.code == DIV)
+            gimm(SHR, at.a, at.b, power(at.k), at.line);
+        else
+        if(at.code == MOD)
+            gimm(AND, at.a, at.b, at.k - 1, at.line);
+        else
+        {
+            struct ins* const in = put(CONST);
+            in->a = at.a;
+            in->line = at.line;
+        }
+    }
+    free(code);
+    return true;
+}
+
+// Pass: removes results nothing reads. Calls, draws and random numbers stay,
+// keeping their side effects.
+static bool dead(struct function* f)
+{
+    int* const count = uses(f);
+    bool changed = false;
+    for(int i = 0; i < f->n; i++)
+    {
+        struct ins* const in = &f->code[i];
+        if(in->a == NONE || count[in->a] > 0)
+            continue;
+        if(pure(in->code))
+            in->code = NOP;
+        else
+            in->a = NONE;
+        changed = true;
+    }
+    free(count);
+    compact(f);
+    return changed;
+}
+
+// Pass: branches to jumps go where the jumps go, branches to the next instruction
+// fall through, code no label leads to after a jump or return goes, and so do
+// labels nothing branches to.
+static bool jumps(struct function* f)
+{
+    bool changed = false;
+    for(int i = 0; i < f->n; i++)
+    {
+        struct ins* const in = &f->code[i];
+        if(!isbranch(in->code))
+            continue;
+        for(int hops = 0; hops < 8; hops++)
+        {
+            int at = where(f, in->k);
+            while(at < f->n && f->code[at].code == LABEL)
+                at++;
+            if(at == f->n || f->code[at].code != JUMP || f->code[at].k == in->k)
+                break;
+            in->k = f->code[at].k;
+            changed = true;
+        }
+        int at = i + 1;
+        while(at < f->n && f->code[at].code == LABEL && f->code[at].k != in->k)
+            at++;
+        if(at < f->n && f->code[at].code == LABEL)
+        {
+            in->code = NOP;
+            changed = true;
+        }
+    }
+    for(int i = 0; i < f->n; i++)
+        if(f->code[i].code == JUMP || f->code[i].code == RET || f->code[i].code == TAIL)
+            for(int j = i + 1; j < f->n && f->code[j].code != LABEL; j++)
+            {
+                f->code[j].code = NOP;
+                changed = true;
+            }
+    compact(f);
+    for(int i = 0; i < f->n; i++)
+    {
+        if(f->code[i].code != LABEL)
+            continue;
+        bool reached = false;
+        for(int j = 0; j < f->n; j++)
+            if(isbranch(f->code[j].code) && f->code[j].k == f->code[i].k)
+                reached = true;
+        if(!reached)
+        {
+            f->code[i].code = NOP;
+            changed = true;
+        }
+    }
+    compact(f);
+    return changed;
+}
+
+// Pass: a call whose value is returned at once becomes a tail call. The caller
+// gives up its frame first, and the callee returns straight to the caller's caller,
+// so recursion in tail position runs in constant stack.
+static bool tail(struct function* f)
+{
+    bool changed = false;
+    for(int i = 0; i + 1 < f->n; i++)
+    {
+        struct ins* const in = &f->code[i];
+        struct ins* const next = &f->code[i + 1];
+        if(in->code == CALL && next->code == RET && next->b == in->a)
+        {
+            in->code = TAIL;
+            in->a = NONE;
+            next->code = NOP;
+            changed = true;
+        }
+    }
+    compact(f);
+    return changed;
+}
+
+// Inlining: callees of at most this many instructions are copied into their callers
+// while the program is estimated to still fit the 3584 bytes a ROM has.
+#define SMALL (12)
+#define ROOM (3584)
+
+// Returns the instructions of a function, not counting labels.
+static int size(const struct function* f)
+{
+    int n = 0;
+    for(int i = 0; i < f->n; i++)
+        n += f->code[i].code != LABEL;
+    return n;
+}
+
+// Returns the estimated bytes of every function, at two chip8 instructions each.
+static int estimate()
+{
+    int bytes = 0;
+    for(int i = 0; i < l; i++)
+        if(labels[i].function)
+            bytes += 4 * size(labels[i].function);
+    return bytes;
+}
+
+// Returns true if copying labels[k] into f costs less than calling it:
+// the callee is small, does not call itself, and the program still fits.
+static bool worth(const struct function* f, const int k)
+{
+    const struct function* const g = labels[k].function;
+    if(g == NULL || g == f || size(g) > SMALL)
+        return false;
+    for(int i = 0; i < g->n; i++)
+        if((g->code[i].code == CALL || g->code[i].code == TAIL) && labels[g->code[i].k].function == g)
+            return false;
+    return estimate() + 4 * size(g) <= ROOM;
+}
+
+// Appends a copy of the code of the function called at, on fresh virtual registers
+// and branch labels. Returns become moves of the value and jumps past the copy,
+// unless the call was a tail call, where they stay returns.
+static void splice(const struct ins* at)
+{
+    const struct function* const g = labels[at->k].function;
+    const int base = fn->vregs;
+    for(int t = 0; t < g->vregs; t++)
+        fresh();
+    int spans = 0;
+    for(int i = 0; i < g->n; i++)
+        if(g->code[i].code == LABEL && g->code[i].k / MARKS + 1 > spans)
+            spans = g->code[i].k / MARKS + 1;
+    const int shift = branch * MARKS;
+    branch += spans;
+    const int end = mark(branch++, END);
+    for(int p = 0; p < at->n; p++)
+    {
+        struct ins* const in = put(MOVE);
+        in->a = base + p;
+        in->b = at->args[p];
+        in->line = at->line;
+    }
+    for(int i = 0; i < g->n; i++)
+    {
+        struct ins copy = g->code[i];
+        int* const operands[] = { &copy.a, &copy.b, &copy.c, &copy.d };
+        for(int j = 0; j < 4; j++)
+            if(*operands[j] != NONE)
+                *operands[j] += base;
+        for(int j = 0; j < copy.n; j++)
+            copy.args[j] += base;
+        if(copy.code == LABEL || isbranch(copy.code))
+            copy.k += shift;
+        copy.line = at->line;
+        if(at->code == TAIL)
+        {
+            *put(NOP) = copy;
+            continue;
+        }
+        if(copy.code == TAIL)
+        {
+            copy.code = CALL;
+            copy.a = at->a;
+            *put(NOP) = copy;
+        }
+        else
+        if(copy.code == RET)
+        {
+            if(at->a != NONE)
+            {
+                struct ins* const in = put(copy.b == NONE ? CONST : MOVE);
+                in->a = at->a;
+                in->b = copy.b;
+                in->line = at->line;
+            }
+        }
+        else
+        {
+            *put(NOP) = copy;
+            continue;
+        }
+        struct ins* const in = put(JUMP);
+        in->k = end;
+        in->line = at->line;
+    }
+    if(at->code == CALL)
+    {
+        struct ins* const in = put(LABEL);
+        in->k = end;
+        in->line = at->line;
+    }
+}
+
+// Pass: calls to small functions become copies of their code.
+static bool expand(struct function* f)
+{
+    bool* const chosen = (bool*) calloc(f->n + 1, sizeof(bool));
+    bool changed = false;
+    for(int i = 0; i < f->n; i++)
+    {
+        const struct ins* const in = &f->code[i];
+        if((in->code == CALL || in->code == TAIL) && worth(f, in->k))
+            changed = chosen[i] = true;
+    }
+    if(changed)
+    {
+        struct ins* const code = f->code;
+        const int n = f->n;
+        f->code = NULL;
+        f->n = f->cap = 0;
+        fn = f;
+        for(int i = 0; i < n; i++)
+            if(chosen[i])
+                splice(&code[i]);
+            else
+                *put(NOP) = code[i];
+        free(code);
+    }
+    free(chosen);
+    return changed;
+}
+
+// Optimization passes, run in order until none changes anything. -n name turns one off.
+static struct pass
+{
+    const char* name;
+    bool (*run)(struct function*);
+    bool off;
+}
+passes[] = {
+    { "inline", expand, false },
+    { "fold",   fold,   false },
+    { "reduce", reduce, false },
+    { "dead",   dead,   false },
+    { "jumps",  jumps,  false },
+    { "tail",   tail,   false },
+};
+
+// Turns a pass off by name.
+static void off(const char* name)
+{
+    if(eql(name, "peephole"))
+    {
+        peeping = false;
+        return;
+    }
+    if(eql(name, "prune"))
+    {
+        pruning = false;
+        return;
+    }
+    for(unsigned i = 0; i < sizeof(passes) / sizeof(*passes); i++)
+        if(eql(name, passes[i].name))
+        {
+            passes[i].off = true;
+            return;
+        }
+    fprintf(stderr, "error: unknown pass '%s'\n", name);
+    exit(1);
+}
+
+static void optimize(struct function* f)
+{
+    for(int round = 0; round < 16; round++)
+    {
+        bool changed = false;
+        for(unsigned i = 0; i < sizeof(passes) / sizeof(*passes); i++)
+            if(!passes[i].off)
+                changed |= passes[i].run(f);
+        if(!changed)
+            return;
+    }
+}
+
+// Returns the runtime routine computing b op c, given b in V0 and c in V1.
+static const char* routine(const int code)
+{
+    return code == MUL ? "__mul" : code == DIV ? "__div" : code == MOD ? "__mod" : code == SHL ? "__shl" : "__shr";
+}
+
+// Returns true if chip8 has no instructions for an operation.
+static bool outlined(const struct ins* in)
+{
+    return in->code >= MUL && in->code <= SHR && !(in->imm && (in->code == SHL || in->code == SHR));
+}
+
+// Operations chip8 has no instructions for become calls to runtime routines.
+// Shifts by constants stay, and lower to runs of single shifts. Runs even with -O0.
+static void outline(struct function* f)
+{
+    bool any = false;
+    for(int i = 0; i < f->n; i++)
+        any |= outlined(&f->code[i]);
+    if(!any)
+        return;
+    struct ins* const code = f->code;
+    const int n = f->n;
+    f->code = NULL;
+    f->n = f->cap = 0;
+    fn = f;
+    for(int i = 0; i < n; i++)
+    {
+        const struct ins at = code[i];
+        if(!outlined(&at))
+        {
+            *put(NOP) = at;
+            continue;
+        }
+        int c = at.c;
+        if(at.imm)
+        {
+            struct ins* const in = put(CONST);
+            in->a = c = fresh();
+            in->k = at.k;
+            in->line = at.line;
+        }
+        struct ins* const in = put(CALL);
+        in->a = at.a;
+        in->k = find(routine(at.code));
+        in->n = 2;
+        in->args[0] = at.b;
+        in->args[1] = c;
+        in->line = at.line;
+    }
+    free(code);
+}
+
+// Registers for virtual registers. VE holds the frame and VF is scratch.
+#define REGS (14)
+
+// Gives the virtual registers an instruction reads, returning how many.
+static int inputs(const struct ins* in, int* t)
+{
+    int n = 0;
+    if(in->b != NONE) t[n++] = in->b;
+    if(in->c != NONE) t[n++] = in->c;
+    if(in->d != NONE) t[n++] = in->d;
+    for(int j = 0; j < in->n; j++)
+        t[n++] = in->args[j];
+    return n;
+}
+
+// Words in a set of virtual registers, one bit each.
+static int words(const struct function* f)
+{
+    return (f->vregs + 63) / 64;
+}
+
+// Returns the virtual registers live after each instruction, words() per instruction.
+static uint64_t* liveness(const struct function* f)
+{
+    const int w = words(f);
+    uint64_t* const out = (uint64_t*) calloc((size_t) f->n * w + 1, sizeof(uint64_t));
+    uint64_t* const in = (uint64_t*) calloc((size_t) (f->n + 1) * w, sizeof(uint64_t));
+    uint64_t* const across = (uint64_t*) calloc(w + 1, sizeof(uint64_t));
+    int* const target = (int*) malloc((f->n + 1) * sizeof(int));
+    for(int i = 0; i < f->n; i++)
+        target[i] = isbranch(f->code[i].code) ? where(f, f->code[i].k) : NONE;
+    for(bool changed = true; changed;)
+    {
+        changed = false;
+        for(int i = f->n - 1; i >= 0; i--)
+        {
+            const struct ins* const at = &f->code[i];
+            uint64_t* const o = &out[(size_t) i * w];
+            uint64_t* const live = &in[(size_t) i * w];
+            for(int j = 0; j < w; j++)
+            {
+                o[j] = at->code == JUMP || at->code == RET || at->code == TAIL ? 0 : in[(size_t) (i + 1) * w + j];
+                if(target[i] != NONE)
+                    o[j] |= in[(size_t) target[i] * w + j];
+            }
+            memcpy(across, o, w * sizeof(uint64_t));
+            if(at->a != NONE)
+                across[at->a / 64] &= ~(1ull << at->a % 64);
+            int t[16];
+            for(int k = inputs(at, t) - 1; k >= 0; k--)
+                across[t[k] / 64] |= 1ull << t[k] % 64;
+            if(memcmp(across, live, w * sizeof(uint64_t)))
+            {
+                memcpy(live, across, w * sizeof(uint64_t));
+                changed = true;
+            }
+        }
+    }
+    free(across);
+    free(target);
+    free(in);
+    return out;
+}
+
+static bool has(const uint64_t* s, const int t)
+{
+    return s[t / 64] >> t % 64 & 1;
+}
+
+// Interference between virtual registers, as a bit matrix.
+static uint64_t* graph;
+
+static void interfere(const struct function* f, const int a, const int b)
+{
+    const int w = words(f);
+    if(a == b)
+        return;
+    graph[(size_t) a * w + b / 64] |= 1ull << b % 64;
+    graph[(size_t) b * w + a / 64] |= 1ull << a % 64;
+}
+
+// Builds the interference graph. A result interferes with everything live after it
+// but the register a move copies. Arguments all arrive together on entry.
+static void conflicts(const struct function* f, const uint64_t* out)
+{
+    const int w = words(f);
+    graph = (uint64_t*) calloc((size_t) f->vregs * w + 1, sizeof(uint64_t));
+    for(int i = 0; i < f->n; i++)
+    {
+        const struct ins* const in = &f->code[i];
+        if(in->a == NONE)
+            continue;
+        for(int t = 0; t < f->vregs; t++)
+            if(has(&out[(size_t) i * w], t) && !(in->code == MOVE && t == in->b))
+                interfere(f, in->a, t);
+    }
+    for(int p = 0; p < f->params; p++)
+        for(int t = 0; t < f->vregs; t++)
+            if(t < f->params || (f->n > 0 && has(&out[0], t) && t != f->code[0].a))
+                interfere(f, p, t);
+}
+
+// Virtual registers coalesced into another share its register. Each names its own
+// representative, or the one it was merged into.
+static int* alias;
+
+static int root(const int t)
+{
+    return alias[t] == t ? t : root(alias[t]);
+}
+
+static int degree(const struct function* f, const int t)
+{
+    int d = 0;
+    for(int j = 0; j < words(f); j++)
+        d += __builtin_popcountll(graph[(size_t) t * words(f) + j]);
+    return d;
+}
+
+// Merges the two sides of each move when they do not interfere and the merged register
+// has fewer than REGS neighbors of REGS or more, so coloring is no harder (Briggs).
+// Registers numbered from fixed on are spill code and stay apart.
+static void coalesce(const struct function* f, const int fixed)
+{
+    const int w = words(f);
+    for(int t = 0; t < f->vregs; t++)
+        alias[t] = t;
+    for(int i = 0; i < f->n; i++)
+    {
+        const struct ins* const in = &f->code[i];
+        if(in->code != MOVE || in->a >= fixed || in->b >= fixed)
+            continue;
+        const int x = root(in->a) < root(in->b) ? root(in->a) : root(in->b);
+        const int y = root(in->a) < root(in->b) ? root(in->b) : root(in->a);
+        if(x == y || has(&graph[(size_t) x * w], y))
+            continue;
+        int significant = 0;
+        for(int u = 0; u < f->vregs; u++)
+        {
+            const bool both = has(&graph[(size_t) x * w], u) && has(&graph[(size_t) y * w], u);
+            if((has(&graph[(size_t) x * w], u) || has(&graph[(size_t) y * w], u))
+            && degree(f, u) - both >= REGS)
+                significant++;
+        }
+        if(significant >= REGS)
+            continue;
+        for(int u = 0; u < f->vregs; u++)
+            if(has(&graph[(size_t) y * w], u))
+            {
+                graph[(size_t) u * w + y / 64] &= ~(1ull << y % 64);
+                interfere(f, x, u);
+            }
+        memset(&graph[(size_t) y * w], 0, w * sizeof(uint64_t));
+        alias[y] = x;
+    }
+}
+
+// Returns the free register virtual register t would rather have, by votes from its
+// moves to colored registers, its places among call arguments and among parameters.
+static int hint(const struct function* f, const int t, const int* regs, const bool* taken)
+{
+    int votes[REGS] = { 0 };
+    for(int i = 0; i < f->n; i++)
+    {
+        const struct ins* const in = &f->code[i];
+        if(in->code == MOVE && root(in->a) == t && regs[root(in->b)] != NONE)
+            votes[regs[root(in->b)]] += 2;
+        if(in->code == MOVE && root(in->b) == t && regs[root(in->a)] != NONE)
+            votes[regs[root(in->a)]] += 2;
+        for(int j = 0; j < in->n; j++)
+            if(root(in->args[j]) == t)
+                votes[j]++;
+    }
+    for(int p = 0; p < f->params; p++)
+        if(root(p) == t)
+            votes[p] += 2;
+    int best = NONE;
+    for(int r = 0; r < REGS; r++)
+        if(!taken[r] && (best == NONE || votes[r] > votes[best]))
+            best = r;
+    return best;
+}
+
+// Colors the interference graph with REGS registers, removing registers of few neighbors
+// first and optimistically pushing the cheapest to spill when none has few. Registers
+// left without a color are marked in lost. Those numbered from fixed on are never spilled.
+static int color(struct function* f, const int fixed, bool* lost)
+{
+    const int w = words(f);
+    const int n = f->vregs;
+    alias = (int*) malloc(n * sizeof(int));
+    coalesce(f, fixed);
+    int* const degrees = (int*) calloc(n, sizeof(int));
+    int* const cost = (int*) calloc(n, sizeof(int));
+    int* const stack = (int*) malloc(n * sizeof(int));
+    bool* const removed = (bool*) calloc(n, sizeof(bool));
+    int left = 0;
+    for(int t = 0; t < n; t++)
+    {
+        degrees[t] = degree(f, t);
+        removed[t] = root(t) != t;
+        left += !removed[t];
+    }
+    for(int i = 0; i < f->n; i++)
+    {
+        int t[16];
+        for(int k = inputs(&f->code[i], t) - 1; k >= 0; k--)
+            cost[root(t[k])]++;
+        if(f->code[i].a != NONE)
+            cost[root(f->code[i].a)]++;
+    }
+    for(int top = 0; top < left; top++)
+    {
+        // Parameters go last, so they are colored first and keep the registers they arrive in.
+        int pick = NONE;
+        for(int t = f->params; t < n + f->params && pick == NONE; t++)
+            if(!removed[t % n] && degrees[t % n] < REGS)
+                pick = t % n;
+        if(pick == NONE)
+            for(int t = 0; t < n; t++)
+                if(!removed[t] && t < fixed
+                && (pick == NONE || cost[t] * degrees[pick] < cost[pick] * degrees[t]))
+                    pick = t;
+        if(pick == NONE)
+            for(int t = 0; t < n && pick == NONE; t++)
+                if(!removed[t])
+                    pick = t;
+        stack[top] = pick;
+        removed[pick] = true;
+        for(int t = 0; t < n; t++)
+            if(has(&graph[(size_t) pick * w], t))
+                degrees[t]--;
+    }
+    int missed = 0;
+    for(int t = 0; t < n; t++)
+        f->regs[t] = NONE;
+    for(int top = left - 1; top >= 0; top--)
+    {
+        const int t = stack[top];
+        bool taken[REGS] = { false };
+        for(int u = 0; u < n; u++)
+            if(f->regs[u] != NONE && has(&graph[(size_t) t * w], u))
+                taken[f->regs[u]] = true;
+        f->regs[t] = hint(f, t, f->regs, taken);
+    }
+    for(int t = 0; t < n; t++)
+    {
+        f->regs[t] = f->regs[root(t)];
+        if(f->regs[t] == NONE)
+        {
+            lost[t] = true;
+            missed++;
+        }
+    }
+    free(degrees);
+    free(cost);
+    free(stack);
+    free(removed);
+    free(alias);
+    return missed;
+}
+
+// Rewrites the code so each lost virtual register lives in a spill slot of its own,
+// loaded into a new register before each read and stored from one after each write.
+static void spill(struct function* f, const bool* lost)
+{
+    const int vregs = f->vregs;
+    int* const slot = (int*) malloc(vregs * sizeof(int));
+    for(int t = 0; t < vregs; t++)
+        slot[t] = lost[t] ? f->spills++ : NONE;
+    struct ins* const code = f->code;
+    const int n = f->n;
+    f->code = NULL;
+    f->n = f->cap = 0;
+    fn = f;
+    for(int p = 0; p < f->params; p++)
+        if(slot[p] != NONE)
+        {
+            struct ins* const in = put(STORE);
+            in->b = p;
+            in->k = slot[p];
+            in->line = n > 0 ? code[0].line : 0;
+        }
+    for(int i = 0; i < n; i++)
+    {
+        struct ins at = code[i];
+        int* const operands[] = { &at.b, &at.c, &at.d };
+        for(int k = 0; k < 3 + at.n; k++)
+        {
+            int* const t = k < 3 ? operands[k] : &at.args[k - 3];
+            if(*t == NONE || slot[*t] == NONE)
+                continue;
+            const int was = *t;
+            struct ins* const in = put(LOAD);
+            in->a = fresh();
+            in->k = slot[was];
+            in->line = at.line;
+            // One load serves every read of the register here.
+            for(int j = k; j < 3 + at.n; j++)
+            {
+                int* const u = j < 3 ? operands[j] : &at.args[j - 3];
+                if(*u == was)
+                    *u = in->a;
+            }
+        }
+        const int was = at.a;
+        if(was != NONE && slot[was] != NONE)
+            at.a = fresh();
+        *put(NOP) = at;
+        if(was != NONE && slot[was] != NONE)
+        {
+            struct ins* const in = put(STORE);
+            in->b = at.a;
+            in->k = slot[was];
+            in->line = at.line;
+        }
+    }
+    free(code);
+    free(slot);
+}
+
+// Returns the chip8 registers holding values live across the call at i.
+static int held(const struct function* f, const uint64_t* out, const int i)
+{
+    const int w = words(f);
+    int mask = 0;
+    for(int t = 0; t < f->vregs; t++)
+        if(t != f->code[i].a && has(&out[i * w], t))
+            mask |= 1 << f->regs[t];
+    return mask;
+}
+
+// Gives every virtual register a chip8 register by coloring the interference graph,
+// spilling to RAM until the coloring fits.
+static void allocate(struct function* f)
+{
+    const int fixed = f->vregs;
+    for(;;)
+    {
+        uint64_t* const out = liveness(f);
+        conflicts(f, out);
+        bool* const lost = (bool*) calloc(f->vregs, sizeof(bool));
+        const int missed = color(f, fixed, lost);
+        free(graph);
+        if(missed == 0)
+            for(int i = 0; i < f->n; i++)
+                if(f->code[i].code == CALL)
+                    f->code[i].live = held(f, out, i);
+        free(out);
+        if(missed > 0)
+            spill(f, lost);
+        free(lost);
+        if(missed == 0)
+            return;
+    }
+}
+
+// Returns the chip8 register of virtual register t, or NONE.
+static int reg(const struct function* f, const int t)
+{
+    return t == NONE ? NONE : f->regs[t];
+}
+
+// Returns the registers labels[k] writes when called. The library and runtime
+// routines are written by hand: getchar uses V0 and V1, putchar V0 to V6,
+// __mul V0 to V2, __div and __mod V0 to V6, and the shifts V0 and V1.
+static int writes(const int k)
+{
+    const struct label* const at = &labels[k];
+    if(at->function)
+        return at->function->clobbers;
+    if(eql(at->name, "getchar"))
+        return 0x0003;
+    if(eql(at->name, "putchar"))
+        return 0x007F;
+    if(eql(at->name, "__mul"))
+        return 0x0007;
+    if(eql(at->name, "__div") || eql(at->name, "__mod"))
+        return 0x007F;
+    if(eql(at->name, "__shl") || eql(at->name, "__shr"))
+        return 0x0003;
+    return 0x3FFF;
+}
+
+// Finds the registers each function writes, counting those its callees write,
+// up to a fixed point over the call graph. A caller need only save what is both
+// live across a call and written by it.
+static void clobbers()
+{
+    for(int i = 0; i < l; i++)
+    {
+        struct function* const f = labels[i].function;
+        if(f == NULL)
+            continue;
+        f->clobbers = 0;
+        for(int t = 0; t < f->params; t++)
+            f->clobbers |= 1 << f->regs[t];
+        for(int j = 0; j < f->n; j++)
+        {
+            const struct ins* const in = &f->code[j];
+            if(in->a != NONE)
+                f->clobbers |= 1 << f->regs[in->a];
+            if(in->code == CALL || in->code == TAIL)
+                f->clobbers |= (1 << in->n) - 1;
+        }
+    }
+    for(bool changed = true; changed;)
+    {
+        changed = false;
+        for(int i = 0; i < l; i++)
+        {
+            struct function* const f = labels[i].function;
+            if(f == NULL)
+                continue;
+            int mask = f->clobbers;
+            for(int j = 0; j < f->n; j++)
+                if(f->code[j].code == CALL || f->code[j].code == TAIL)
+                    mask |= writes(f->code[j].k);
+            if(mask != f->clobbers)
+            {
+                f->clobbers = mask;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Returns the name of branch label k.
+static char* tag(const int k)
+{
+    static char name[32];
+    snprintf(name, sizeof(name), "%s%d", marks[k % MARKS], k / MARKS);
+    return name;
+}
+
+// Writes the three address code of every function (-i).
+static void listir(FILE* const fp)
+{
+    for(int i = 0; i < l; i++)
+    {
+        const struct function* const f = labels[i].function;
+        if(f == NULL)
+            continue;
+        fprintf(fp, "%s(%d):\n", labels[i].name, f->params);
+        for(int j = 0; j < f->n; j++)
+        {
+            const struct ins* const in = &f->code[j];
+            if(in->code == LABEL)
+            {
+                fprintf(fp, "%s:\n", tag(in->k));
+                continue;
+            }
+            fprintf(fp, "\t");
+            if(in->a != NONE)
+                fprintf(fp, "t%d = ", in->a);
+            switch(in->code)
+            {
+            case CONST: fprintf(fp, "0x%02X", in->k); break;
+            case MOVE: fprintf(fp, "t%d", in->b); break;
+            case NEG: case INV: case NOT: case BOOL: fprintf(fp, "%st%d", signs[in->code], in->b); break;
+            case JUMP: fprintf(fp, "jump %s", tag(in->k)); break;
+            case JZ: fprintf(fp, "jz t%d %s", in->b, tag(in->k)); break;
+            case JNZ: fprintf(fp, "jnz t%d %s", in->b, tag(in->k)); break;
+            case CALL:
+            case TAIL:
+                fprintf(fp, in->code == TAIL ? "return %s(" : "%s(", labels[in->k].name);
+                for(int k = 0; k < in->n; k++)
+                    fprintf(fp, k ? ", t%d" : "t%d", in->args[k]);
+                fprintf(fp, ")");
+                break;
+            case DRAW:
+                fprintf(fp, "draw(t%d, t%d, %s", in->b, in->c, labels[in->k].name);
+                if(in->d != NONE)
+                    fprintf(fp, "[t%d]", in->d);
+                fprintf(fp, ")");
+                break;
+            case RAND: fprintf(fp, "rand()"); break;
+            case CLEAR: fprintf(fp, "clear()"); break;
+            case RET: in->b == NONE ? fprintf(fp, "return") : fprintf(fp, "return t%d", in->b); break;
+            case LOAD: fprintf(fp, "spill[%d]", in->k); break;
+            case STORE: fprintf(fp, "spill[%d] = t%d", in->k, in->b); break;
+            default:
+                if(in->imm)
+                    fprintf(fp, "t%d %s 0x%02X", in->b, signs[in->code], in->k);
+                else
+                    fprintf(fp, "t%d %s t%d", in->b, signs[in->code], in->c);
+                break;
+            }
+            fprintf(fp, "\n");
+        }
+    }
+}
+
+// Echoes source lines up to line n as comments.
+static void echo(const int n)
+{
+    while(echoed < n && echoed < nsources)
+        print(";%s", sources[echoed++]);
+}
+
+// Returns the five byte blocks of spill slots a function keeps above its frame.
+static int units(const struct function* f)
+{
+    return (f->spills + 4) / 5;
+}
+
+// Returns the five byte blocks a frame saving V0 to Vm takes.
+static int blocks(const int m)
+{
+    return m / 5 + 1;
+}
+
+// Generate frame push, saving V0 to Vm.
+static void gfpush(const int m)
+{
+    print("\tLD F,VE");
+    print("\tLD [I],V%1X", m);
+    print("\tADD VE,0x%02X", blocks(m));
+}
+
+// Generate frame pop, restoring V0 to Vm.
+static void gfpop(const int m)
+{
+    print("\tADD VE,0x%02X", -blocks(m) & 0xFF);
+    print("\tLD F,VE");
+    print("\tLD V%1X,[I]", m);
+}
+
+// Generate return of register x unless it is NONE.
+// Blocks of spill slots above the frame are given back.
+static void gret(const int x, const int spilled)
+{
+    if(x != NONE)
+        print("\tLD VF,V%1X", x);
+    if(spilled > 0)
+        print("\tADD VE,0x%02X", -spilled & 0xFF);
+    print("\tRET");
+}
+
+// Moves registers src into registers dst all at once, breaking cycles through VF.
+static void shuffle(const int* dst, int* src, const int n)
+{
+    bool done[16] = { false };
+    for(;;)
+    {
+        bool left = false;
+        bool moved = false;
+        for(int i = 0; i < n; i++)
+        {
+            if(done[i])
+                continue;
+            if(dst[i] == src[i])
+            {
+                done[i] = true;
+                continue;
+            }
+            left = true;
+            // A register is only written once no other move still reads it.
+            bool read = false;
+            for(int j = 0; j < n; j++)
+                if(!done[j] && j != i && src[j] == dst[i])
+                    read = true;
+            if(read)
+                continue;
+            print("\tLD V%1X,V%1X", dst[i], src[i]);
+            done[i] = true;
+            moved = true;
+        }
+        if(!left)
+            return;
+        if(!moved)
+            for(int i = 0; i < n; i++)
+                if(!done[i])
+                {
+                    print("\tLD VF,V%1X", dst[i]);
+                    for(int j = 0; j < n; j++)
+                        if(!done[j] && src[j] == dst[i])
+                            src[j] = 0xF;
+                    break;
+                }
+    }
+}
+
+// Returns the chip8 mnemonic of an arithmetic code.
+static const char* mnemonic(const int code)
+{
+    return code == ADD ? "ADD" : code == SUB ? "SUB" : code == AND ? "AND" : code == OR ? "OR" : "XOR";
+}
+
+// Lowers a = b op c (or k) to the two address chip8 forms. VF is scratch.
+static void garith(const struct ins* in, const int a, const int b, const int c)
+{
+    const char* const m = mnemonic(in->code);
+    if(in->imm)
+    {
+        if(a != b)
+            print("\tLD V%1X,V%1X", a, b);
+        if(in->code == ADD || in->code == SUB)
+            print("\tADD V%1X,0x%02X", a, (in->code == ADD ? in->k : -in->k) & 0xFF);
+        else
+        {
+            print("\tLD VF,0x%02X", in->k);
+            print("\t%s V%1X,VF", m, a);
+        }
+    }
+    else
+    if(a == b)
+        print("\t%s V%1X,V%1X", m, a, c);
+    else
+    if(a == c && in->code == SUB)
+        print("\tSUBN V%1X,V%1X", a, b);
+    else
+    if(a == c)
+        print("\t%s V%1X,V%1X", m, a, b);
+    else
+    {
+        print("\tLD V%1X,V%1X", a, b);
+        print("\t%s V%1X,V%1X", m, a, c);
+    }
+}
+
+// Lowers a = b << k and a = b >> k. Each shift reads and writes the same register,
+// so it works with or without the shift quirk.
+static void gshift(const struct ins* in, const int a, const int b)
+{
+    if(a != b)
+        print("\tLD V%1X,V%1X", a, b);
+    for(int i = 0; i < in->k; i++)
+        print(in->code == SHL ? "\tSHL V%1X,V%1X" : "\tSHR V%1X,V%1X", a, a);
+}
+
+// Lowers a = b == c and a = b != c with skips. VF is scratch when a is read.
+static void gequal(const struct ins* in, const int a, const int b, const int c)
+{
+    const int s = a == b || a == c ? 0xF : a;
+    const char* const skip = in->code == EQ ? "SNE" : "SE";
+    print("\tLD V%1X,0x00", s);
+    if(in->imm)
+        print("\t%s V%1X,0x%02X", skip, b, in->k);
+    else
+        print("\t%s V%1X,V%1X", skip, b, c);
+    print("\tLD V%1X,0x01", s);
+    if(s != a)
+        print("\tLD V%1X,VF", a);
+}
+
+// Lowers orderings with the borrow flag of a subtraction, which is x >= y.
+// GE and LT subtract c from b. LE and GT subtract b from c.
+static void gorder(const struct ins* in, const int a, const int b, const int c)
+{
+    const bool swapped = in->code == LE || in->code == GT;
+    if(in->imm)
+    {
+        if(a != b)
+            print("\tLD V%1X,V%1X", a, b);
+        print("\tLD VF,0x%02X", in->k);
+        print(swapped ? "\tSUBN V%1X,VF" : "\tSUB V%1X,VF", a);
+    }
+    else
+    if(a == b)
+        print(swapped ? "\tSUBN V%1X,V%1X" : "\tSUB V%1X,V%1X", a, c);
+    else
+    if(a == c)
+        print(swapped ? "\tSUB V%1X,V%1X" : "\tSUBN V%1X,V%1X", a, b);
+    else
+    {
+        print("\tLD V%1X,V%1X", a, b);
+        print(swapped ? "\tSUBN V%1X,V%1X" : "\tSUB V%1X,V%1X", a, c);
+    }
+    print("\tLD V%1X,VF", a);
+    if(in->code == LT || in->code == GT)
+    {
+        print("\tLD VF,0x01");
+        print("\tXOR V%1X,VF", a);
+    }
+}
+
+// Lowers a = -b, ~b, !b and !!b.
+static void gunop(const struct ins* in, const int a, const int b)
+{
+    switch(in->code)
+    {
+    case NEG:
+        if(a != b)
+        {
+            print("\tLD V%1X,0x00", a);
+            print("\tSUB V%1X,V%1X", a, b);
+        }
+        else
+        {
+            print("\tLD VF,0x00");
+            print("\tSUBN V%1X,VF", a);
+        }
+        break;
+    case INV:
+        if(a != b)
+            print("\tLD V%1X,V%1X", a, b);
+        print("\tLD VF,0xFF");
+        print("\tXOR V%1X,VF", a);
+        break;
+    case NOT:
+    case BOOL:
+        {
+            const int s = a == b ? 0xF : a;
+            print("\tLD V%1X,0x00", s);
+            print(in->code == NOT ? "\tSNE V%1X,0x00" : "\tSE V%1X,0x00", b);
+            print("\tLD V%1X,0x01", s);
+            if(s != a)
+                print("\tLD V%1X,VF", a);
+        }
+        break;
+    }
+}
+
+// Lowers a call. The caller saves the registers live across the call that the
+// callee or the arguments overwrite, then arguments move into V0 onward.
+// The callee returns its value in VF, and the caller restores the frame.
+// Nothing to save means no frame at all.
+static void gcall(const struct function* f, const struct ins* in)
+{
+    const int save = in->live & (writes(in->k) | ((1 << in->n) - 1));
+    int m = NONE;
+    for(int x = 0; x < 16; x++)
+        if(save >> x & 1)
+            m = x;
+    if(m != NONE)
+        gfpush(m);
+    int dst[16];
+    int src[16];
+    for(int i = 0; i < in->n; i++)
+    {
+        dst[i] = i;
+        src[i] = reg(f, in->args[i]);
+    }
+    shuffle(dst, src, in->n);
+    print("\tCALL %s", labels[in->k].name);
+    if(m != NONE)
+        gfpop(m);
+    if(in->a != NONE)
+        print("\tLD V%1X,VF", reg(f, in->a));
+}
+
+// Lowers a tail call. Arguments move into V0 onward, the spill slots are
+// given back, and the callee returns for this function.
+static void gtail(const struct function* f, const struct ins* in)
+{
+    int dst[16];
+    int src[16];
+    for(int i = 0; i < in->n; i++)
+    {
+        dst[i] = i;
+        src[i] = reg(f, in->args[i]);
+    }
+    shuffle(dst, src, in->n);
+    if(units(f) > 0)
+        print("\tADD VE,0x%02X", -units(f) & 0xFF);
+    print("\tJP %s", labels[in->k].name);
+}
+
+// Lowers a draw. A row of a sprite array is found by adding the row to I once per sprite byte.
+static void gdraw(const struct function* f, const struct ins* in)
+{
+    const struct label* const sprite = &labels[in->k];
+    print("\tLD I,%s", sprite->name);
+    if(in->d != NONE)
+        for(int i = 0; i < sprite->args; i++)
+            print("\tADD I,V%1X", reg(f, in->d));
+    print("\tDRW V%1X,V%1X,0x%1X", reg(f, in->b), reg(f, in->c), sprite->args);
+    if(in->a != NONE)
+        print("\tLD V%1X,VF", reg(f, in->a));
+}
+
+// Lowers a spill load or store. The prologue reserves the spill slots in the blocks
+// below VE. A byte moves through V0, the one register FX55 and FX65 can move alone.
+static void gspill(const struct function* f, const struct ins* in)
+{
+    const int x = in->code == LOAD ? reg(f, in->a) : reg(f, in->b);
+    print("\tLD VF,VE");
+    print("\tADD VF,0x%02X", -units(f) & 0xFF);
+    print("\tLD F,VF");
+    if(in->k > 0)
+    {
+        print("\tLD VF,0x%02X", in->k);
+        print("\tADD I,VF");
+    }
+    if(x != 0)
+    {
+        print("\tLD VF,V0");
+        if(in->code == STORE)
+            print("\tLD V0,V%1X", x);
+    }
+    print(in->code == LOAD ? "\tLD V0,[I]" : "\tLD [I],V0");
+    if(x != 0)
+    {
+        if(in->code == LOAD)
+            print("\tLD V%1X,V0", x);
+        print("\tLD V0,VF");
+    }
+}
+
+// Lowers one instruction.
+static void gins(const struct function* f, const struct ins* in)
+{
+    const int a = reg(f, in->a);
+    const int b = reg(f, in->b);
+    const int c = reg(f, in->c);
+    switch(in->code)
+    {
+    case CONST:
+        print("\tLD V%1X,0x%02X", a, in->k);
+        break;
+    case MOVE:
+        if(a != b)
+            print("\tLD V%1X,V%1X", a, b);
+        break;
+    case NEG: case INV: case NOT: case BOOL:
+        gunop(in, a, b);
+        break;
+    case ADD: case SUB: case AND: case OR: case XOR:
+        garith(in, a, b, c);
+        break;
+    case SHL: case SHR:
+        gshift(in, a, b);
+        break;
+    case EQ: case NE:
+        gequal(in, a, b, c);
+        break;
+    case LT: case LE: case GT: case GE:
+        gorder(in, a, b, c);
+        break;
+    case LABEL:
+        print("%s:", tag(in->k));
+        break;
+    case JUMP:
+        print("\tJP %s", tag(in->k));
+        break;
+    case JZ:
+    case JNZ:
+        print(in->code == JZ ? "\tSNE V%1X,0x00" : "\tSE V%1X,0x00", b);
+        print("\tJP %s", tag(in->k));
+        break;
+    case CALL:
+        gcall(f, in);
+        break;
+    case TAIL:
+        gtail(f, in);
+        break;
+    case DRAW:
+        gdraw(f, in);
+        break;
+    case RAND:
+        print("\tRND V%1X,0xFF", a == NONE ? 0xF : a);
+        break;
+    case CLEAR:
+        print("\tCLS");
+        break;
+    case RET:
+        gret(b, units(f));
+        break;
+    case LOAD:
+    case STORE:
+        gspill(f, in);
+        break;
+    }
+}
+
+// Lowers a function.
+static void lower(const struct label* at)
+{
+    const struct function* const f = at->function;
+    echo(at->line);
+    print("%s:", at->name);
+    // VE must start here for stack space to avoid
+    // trampling over the built in font array.
+    if(eql(at->name, "main"))
+        print("\tLD VE,0x10");
+    if(units(f) > 0)
+        print("\tADD VE,0x%02X", units(f));
+    // Arguments arrive in V0 onward.
+    int dst[16];
+    int src[16];
+    for(int i = 0; i < f->params; i++)
+    {
+        dst[i] = reg(f, i);
+        src[i] = i;
+    }
+    shuffle(dst, src, f->params);
+    for(int i = 0; i < f->n; i++)
+    {
+        echo(f->code[i].line);
+        gins(f, &f->code[i]);
+    }
+}
+
+// Get character.
+static void getchr()
+{
+    print("getchar:");
+    print("\tLD V0,0xFF"); // Return value.
+    print("\tLD V1,0x00\n\tSKNP V1\n\tLD V0,0x00");
+    print("\tLD V1,0x01\n\tSKNP V1\n\tLD V0,0x01");
+    print("\tLD V1,0x02\n\tSKNP V1\n\tLD V0,0x02");
+    print("\tLD V1,0x03\n\tSKNP V1\n\tLD V0,0x03");
+    print("\tLD V1,0x04\n\tSKNP V1\n\tLD V0,0x04");
+    print("\tLD V1,0x05\n\tSKNP V1\n\tLD V0,0x05");
+    print("\tLD V1,0x06\n\tSKNP V1\n\tLD V0,0x06");
+    print("\tLD V1,0x07\n\tSKNP V1\n\tLD V0,0x07");
+    print("\tLD V1,0x08\n\tSKNP V1\n\tLD V0,0x08");
+    print("\tLD V1,0x09\n\tSKNP V1\n\tLD V0,0x09");
+    print("\tLD V1,0x0A\n\tSKNP V1\n\tLD V0,0x0A");
+    print("\tLD V1,0x0B\n\tSKNP V1\n\tLD V0,0x0B");
+    print("\tLD V1,0x0C\n\tSKNP V1\n\tLD V0,0x0C");
+    print("\tLD V1,0x0D\n\tSKNP V1\n\tLD V0,0x0D");
+    print("\tLD V1,0x0E\n\tSKNP V1\n\tLD V0,0x0E");
+    print("\tLD V1,0x0F\n\tSKNP V1\n\tLD V0,0x0F");
+    // Done, restore return value.
+    gret(0x0, 0);
+}
+
+// Put charater.
+static void putchr()
+{
+    const int spacing = 1;
+    const int width = 4;
+    print("putchar:");
+    // Shift up: V0, V1, V2 will be populated by I, I+1, I+2.
+    print("\tLD V5,V2"); // N
+    print("\tLD V4,V1"); // Y
+    print("\tLD V3,V0"); // X
+    // V6 will serve as a collision flag.
+    print("\tLD V6,0x00");
+    // The digits go to the free stack above VE.
+    print("\tLD F,VE");
+    print("\tLD B,V5");
+    print("\tLD V2,[I]");
+    // First.
+    print("\tLD F,V0");
+    print("\tDRW V3,V4,0x5");
+    print("\tOR V6,VF");
+    // Second.
+    print("\tLD F,V1");
+    print("\tADD V3,0x%02X", width + spacing);
+    print("\tDRW V3,V4,0x5");
+    print("\tOR V6,VF");
+    // Third.
+    print("\tLD F,V2");
+    print("\tADD V3,0x%02X", width + spacing);
+    print("\tDRW V3,V4,0x5");
+    print("\tOR V6,VF");
+    // Done. Restore return value.
+    gret(0x6, 0);
+}
+
+void stdio()
+{
+    const bool in = labels[find("getchar")].used;
+    const bool out = labels[find("putchar")].used;
+    if(in || out)
+        print(";stdio: Standard Input and Output library");
+    if(in)
+        getchr();
+    if(out)
+        putchr();
+}
+
+// Multiply V0 by V1, adding V0 for each bit of V1 as one shifts left and the other right.
+static void gmul()
+{
+    print("__mul:");
+    print("\tLD V2,0x00");
+    print("__mul1:");
+    print("\tSNE V1,0x00");
+    print("\tJP __mul2");
+    print("\tSHR V1,V1");
+    print("\tSE VF,0x00");
+    print("\tADD V2,V0");
+    print("\tSHL V0,V0");
+    print("\tJP __mul1");
+    print("__mul2:");
+    print("\tLD VF,V2");
+    print("\tRET");
+}
+
+// Divide V0 by V1, restoring one bit a round. The dividend shifts into the
+// remainder V3 and the quotient shifts into the dividend. V6 keeps the bit shifted
+// out of the remainder, which must then be subtracted from.
+static void gdiv()
+{
+    print("__mod:");
+    print("\tLD V2,0x01");
+    print("\tJP __divide");
+    print("__div:");
+    print("\tLD V2,0x00");
+    print("__divide:");
+    print("\tLD V3,0x00");
+    print("\tLD V4,0x08");
+    print("__divide1:");
+    print("\tSHL V0,V0");
+    print("\tLD V5,VF");
+    print("\tSHL V3,V3");
+    print("\tLD V6,VF");
+    print("\tOR V3,V5");
+    print("\tLD V5,V3");
+    print("\tSUB V5,V1");
+    print("\tOR V6,VF");
+    print("\tSNE V6,0x00");
+    print("\tJP __divide2");
+    print("\tLD V3,V5");
+    print("\tADD V0,0x01");
+    print("__divide2:");
+    print("\tADD V4,0xFF");
+    print("\tSE V4,0x00");
+    print("\tJP __divide1");
+    print("\tLD VF,V0");
+    print("\tSE V2,0x00");
+    print("\tLD VF,V3");
+    print("\tRET");
+}
+
+// Shift V0 by V1, one bit at a time.
+static void gshifts(const char* name, const char* m)
+{
+    print("%s:", name);
+    print("\tSNE V1,0x00");
+    print("\tJP %s1", name);
+    print("\t%s V0,V0", m);
+    print("\tADD V1,0xFF");
+    print("\tJP %s", name);
+    print("%s1:", name);
+    print("\tLD VF,V0");
+    print("\tRET");
+}
+
+// Links the runtime routines something calls.
+static void runtime()
+{
+    if(labels[find("__mul")].used)
+        gmul();
+    if(labels[find("__div")].used || labels[find("__mod")].used)
+        gdiv();
+    if(labels[find("__shl")].used)
+        gshifts("__shl", "SHL");
+    if(labels[find("__shr")].used)
+        gshifts("__shr", "SHR");
+}
+
+// Marks labels[k] and everything it calls or draws as used.
+static void reach(const int k)
+{
+    if(labels[k].used)
+        return;
+    labels[k].used = true;
+    const struct function* const f = labels[k].function;
+    if(f)
+        for(int i = 0; i < f->n; i++)
+        {
+            const int code = f->code[i].code;
+            if(code == CALL || code == TAIL || code == DRAW)
+                reach(f->code[i].k);
+        }
+}
+
+// Finds what main reaches, so functions, sprites and routines nothing
+// reaches are left out. Without a main, or when not pruning, every
+// function and sprite is kept, with what they reach.
+static void prune()
+{
+    const int start = find("main");
+    for(int i = 0; i < l; i++)
+        labels[i].used = false;
+    for(int i = 0; i < l; i++)
+        if(i == start || ((start == -1 || !pruning) && (labels[i].function || labels[i].height > 0)))
+            reach(i);
+}
+
+// Declaring a program.
+// Programs are defined by functions and spirte arrays.
+static void program()
+{
+    while(now != EOF)
+    {
+        char* n = name();
+        skip();
+        switch(now)
+        {
+        case '[':
+        case '=':
+            arr(n);
+            break;
+        case '(':
+            fun(n);
+            break;
+        default:
+            bomb("symbol '%c' not known", now);
+            break;
+        }
+        skip();
+    }
+}
+
+// Lowers every function and sprite main reaches in source order, then links the libraries.
+static void generate()
+{
+    for(int i = 0; i < l; i++)
+    {
+        const struct label* const at = &labels[i];
+        if(!at->used)
+            continue;
+        if(at->function)
+            lower(at);
+        else
+        if(at->height > 0)
+        {
+            echo(at->line);
+            print("%s:", at->name);
+            for(int j = 0; j < at->args * at->height; j++)
+                print("\tDB 0x%02X", at->bytes[j]);
+        }
+    }
+    echo(nsources);
+    // Libraries to link at compile time.
+    stdio();
+    runtime();
+}
+
+// Peephole rules over the output assembly, tried at every line until none applies.
+// In patterns %a to %e match registers, %k a constant, %x either and %l a label.
+// Different names never match the same text. %-k in a replacement is the negated constant.
+// Registers listed as dead must be written before they are read on every path after a match.
+static const struct rule
+{
+    const char* find[5];
+    const char* make[2];
+    const char* dead[2];
+}
+rules[] = {
+    { { "JP %l", "%l:" }, { "%l:" }, { NULL } },
+    { { "LD %a,%a" }, { NULL }, { NULL } },
+    { { "ADD %a,0x00" }, { NULL }, { NULL } },
+    { { "LD %a,%x" }, { NULL }, { "%a" } },
+    { { "LD %a,%b", "LD %b,%a" }, { "LD %a,%b" }, { NULL } },
+    { { "LD %a,%x", "LD %b,%a" }, { "LD %b,%x" }, { "%a" } },
+    { { "LD %a,%k", "ADD %b,%a" }, { "ADD %b,%k" }, { "%a", "VF" } },
+    { { "LD %a,%k", "SUB %b,%a" }, { "ADD %b,%-k" }, { "%a", "VF" } },
+    { { "LD %a,%b", "SE %a,%x" }, { "SE %b,%x" }, { "%a" } },
+    { { "LD %a,%b", "SNE %a,%x" }, { "SNE %b,%x" }, { "%a" } },
+    // A comparison only read by a branch becomes one skip over the jump.
+    { { "LD %a,0x00", "SNE %b,%x", "LD %a,0x01", "SNE %a,0x00", "JP %l" }, { "SE %b,%x", "JP %l" }, { "%a" } },
+    { { "LD %a,0x00", "SE %b,%x", "LD %a,0x01", "SNE %a,0x00", "JP %l" }, { "SNE %b,%x", "JP %l" }, { "%a" } },
+    { { "LD %a,0x00", "SNE %b,%x", "LD %a,0x01", "SE %a,0x00", "JP %l" }, { "SNE %b,%x", "JP %l" }, { "%a" } },
+    { { "LD %a,0x00", "SE %b,%x", "LD %a,0x01", "SE %a,0x00", "JP %l" }, { "SE %b,%x", "JP %l" }, { "%a" } },
+    // An inverted borrow flag only read by a branch is branched on as it is.
+    { { "LD %a,VF", "LD VF,0x01", "XOR %a,VF", "SNE %a,0x00", "JP %l" }, { "SE VF,0x00", "JP %l" }, { "%a", "VF" } },
+    { { "LD %a,VF", "LD VF,0x01", "XOR %a,VF", "SE %a,0x00", "JP %l" }, { "SNE VF,0x00", "JP %l" }, { "%a", "VF" } },
+};
+
+// Output assembly lines under the peephole pass. Removed lines are NULL.
+static char** lines;
+
+static int nlines;
+
+// Returns the first line from i on that is code or a label.
+static int code(int i)
+{
+    while(i < nlines && (lines[i] == NULL || lines[i][0] == ';'))
+        i++;
+    return i;
+}
+
+// Returns a line without the tab of an instruction.
+static const char* body(const char* s)
+{
+    return s[0] == '\t' ? s + 1 : s;
+}
+
+// Returns the register named by t, or NONE.
+static int regof(const char* t)
+{
+    const char* const hex = "0123456789ABCDEF";
+    return t[0] == 'V' && t[1] != '\0' && t[2] == '\0' && strchr(hex, t[1]) ? (int) (strchr(hex, t[1]) - hex) : NONE;
+}
+
+// Splits an instruction into its mnemonic and up to three operands, returning the operand count.
+static int split(const char* s, char m[8], char o[3][16])
+{
+    int k = 0;
+    while(*s && *s != ' ' && k < 7)
+        m[k++] = *s++;
+    m[k] = '\0';
+    if(*s == ' ')
+        s++;
+    int n = 0;
+    while(*s && n < 3)
+    {
+        k = 0;
+        while(*s && *s != ',' && k < 15)
+            o[n][k++] = *s++;
+        o[n++][k] = '\0';
+        if(*s == ',')
+            s++;
+    }
+    return n;
+}
+
+static bool isskip(const char* m)
+{
+    return eql(m, "SE") || eql(m, "SNE") || eql(m, "SKP") || eql(m, "SKNP");
+}
+
+// Returns the mnemonic of line i if it is an instruction, else an empty string.
+static const char* mnem(const int i)
+{
+    static char m[8];
+    char o[3][16];
+    m[0] = '\0';
+    if(lines[i] && lines[i][0] == '\t')
+        split(lines[i] + 1, m, o);
+    return m;
+}
+
+// Returns the line of label name, or nlines.
+static int landing(const char* name)
+{
+    const size_t n = strlen(name);
+    for(int i = 0; i < nlines; i++)
+        if(lines[i] && strncmp(lines[i], name, n) == 0 && eql(lines[i] + n, ":"))
+            return i;
+    return nlines;
+}
+
+// Returns the line after the instruction following line i, where a skip at i lands.
+static int past(int i)
+{
+    for(i++; i < nlines && (lines[i] == NULL || lines[i][0] != '\t'); i++);
+    return i + 1;
+}
+
+// Gathers the registers an instruction reads and writes as bit masks.
+// Returns false for instructions not known here.
+static bool effect(const char* m, char o[3][16], const int n, int* rd, int* wr)
+{
+    const int x = n > 0 ? regof(o[0]) : NONE;
+    const int y = n > 1 ? regof(o[1]) : NONE;
+    const int bx = x == NONE ? 0 : 1 << x;
+    const int by = y == NONE ? 0 : 1 << y;
+    *rd = 0;
+    *wr = 0;
+    if(eql(m, "CLS"))
+        return true;
+    // Callees read their arguments and return in VF.
+    if(eql(m, "CALL"))
+    {
+        *rd = 0x7FFF;
+        *wr = 0x8000;
+        return true;
+    }
+    if(eql(m, "RET"))
+    {
+        *rd = 0xFFFF;
+        return true;
+    }
+    if(eql(m, "LD") && n == 2)
+    {
+        if(eql(o[1], "[I]") && x != NONE)
+            *wr = (2 << x) - 1;
+        else
+        if(eql(o[0], "[I]") && y != NONE)
+            *rd = (2 << y) - 1;
+        else
+        {
+            *rd = by;
+            *wr = bx;
+        }
+        return true;
+    }
+    if(eql(m, "ADD") && n == 2)
+    {
+        *rd = bx | by;
+        *wr = bx | (x != NONE && y != NONE ? 0x8000 : 0);
+        return true;
+    }
+    if((eql(m, "OR") || eql(m, "AND") || eql(m, "XOR")) && n == 2)
+    {
+        *rd = bx | by;
+        *wr = bx;
+        return true;
+    }
+    if(eql(m, "SUB") || eql(m, "SUBN") || eql(m, "SHR") || eql(m, "SHL"))
+    {
+        *rd = bx | by;
+        *wr = bx | 0x8000;
+        return true;
+    }
+    if(eql(m, "RND"))
+    {
+        *wr = bx;
+        return true;
+    }
+    if(eql(m, "DRW"))
+    {
+        *rd = bx | by;
+        *wr = 0x8000;
+        return true;
+    }
+    if(isskip(m))
+    {
+        *rd = bx | by;
+        return true;
+    }
+    return false;
+}
+
+// Returns true when register x is written before it is read on every path from line i.
+// Jumps and skips are followed for as many instructions as the budget allows.
+// A label already seen is being followed elsewhere, so its reads are found there.
+static bool unread(const int x, int i, int* budget, bool* seen)
+{
+    for(i = code(i); i < nlines; i = code(i + 1))
+    {
+        if(lines[i][0] != '\t')
+            continue;
+        if(--*budget < 0)
+            return false;
+        char m[8];
+        char o[3][16];
+        const int n = split(lines[i] + 1, m, o);
+        if(eql(m, "JP"))
+        {
+            if(n != 1)
+                return false;
+            i = landing(o[0]);
+            if(i == nlines)
+                return false;
+            if(seen[i])
+                return true;
+            seen[i] = true;
+            continue;
+        }
+        int rd;
+        int wr;
+        if(!effect(m, o, n, &rd, &wr) || rd & 1 << x)
+            return false;
+        if(wr & 1 << x)
+            return true;
+        if(isskip(m))
+            return unread(x, i + 1, budget, seen) && unread(x, past(i), budget, seen);
+    }
+    return false;
+}
+
+// Returns true when register x is dead on every way out of the matched lines.
+static bool gone(const int x, const int* at, const int n)
+{
+    if(x == NONE)
+        return false;
+    int budget = 256;
+    bool* const seen = (bool*) calloc(nlines, sizeof(bool));
+    bool dead = unread(x, at[n - 1] + 1, &budget, seen);
+    if(isskip(mnem(at[n - 1])))
+        dead = dead && unread(x, past(at[n - 1]), &budget, seen);
+    for(int k = 0; k < n; k++)
+        if(eql(mnem(at[k]), "JP"))
+            dead = dead && unread(x, at[k], &budget, seen);
+    free(seen);
+    return dead;
+}
+
+// Matches line s against pattern p, binding names in got.
+static bool fits(const char* p, const char* s, char got[26][16])
+{
+    while(*p)
+    {
+        if(*p != '%')
+        {
+            if(*p++ != *s++)
+                return false;
+            continue;
+        }
+        const char w = p[1];
+        p += 2;
+        char t[16];
+        int n = 0;
+        while(*s && *s != ',' && *s != ':' && *s != ' ' && n < 15)
+            t[n++] = *s++;
+        t[n] = '\0';
+        const bool isreg = regof(t) != NONE;
+        const bool isnum = strncmp(t, "0x", 2) == 0;
+        if(n == 0
+        || (w == 'k' && !isnum)
+        || (w == 'x' && !isreg && !isnum)
+        || (w >= 'a' && w <= 'e' && !isreg))
+            return false;
+        char* const bound = got[w - 'a'];
+        if(bound[0] != '\0')
+        {
+            if(!eql(bound, t))
+                return false;
+            continue;
+        }
+        for(int i = 0; i < 26; i++)
+            if(eql(got[i], t))
+                return false;
+        strcpy(bound, t);
+    }
+    return *s == '\0';
+}
+
+// Fills replacement pattern p with the names bound in got.
+static char* form(const char* p, char got[26][16])
+{
+    char s[64];
+    int n = 0;
+    if(p[strlen(p) - 1] != ':')
+        s[n++] = '\t';
+    while(*p)
+        if(*p != '%')
+            s[n++] = *p++;
+        else
+        if(p[1] == '-')
+        {
+            n += sprintf(s + n, "0x%02X", -(int) strtol(got[p[2] - 'a'], NULL, 0) & 0xFF);
+            p += 3;
+        }
+        else
+        {
+            n += sprintf(s + n, "%s", got[p[1] - 'a']);
+            p += 2;
+        }
+    s[n] = '\0';
+    return dup(s);
+}
+
+// Applies rule r to the lines from i on. Comments within the match stay where they are.
+static bool rewrite(const struct rule* r, const int i)
+{
+    // The first line must not be the one a skip jumps over.
+    int before = i - 1;
+    while(before >= 0 && (lines[before] == NULL || lines[before][0] != '\t'))
+        before--;
+    if(before >= 0 && isskip(mnem(before)))
+        return false;
+    char got[26][16];
+    memset(got, 0, sizeof(got));
+    int at[5];
+    int n = 0;
+    for(int j = i; n < 5 && r->find[n]; j = code(j + 1))
+    {
+        if(j == nlines || !fits(r->find[n], body(lines[j]), got))
+            return false;
+        at[n++] = j;
+    }
+    for(int k = 0; k < 2 && r->dead[k]; k++)
+        if(!gone(regof(r->dead[k][0] == '%' ? got[r->dead[k][1] - 'a'] : r->dead[k]), at, n))
+            return false;
+    for(int k = 0; k < n; k++)
+    {
+        free(lines[at[k]]);
+        lines[at[k]] = k < 2 && r->make[k] ? form(r->make[k], got) : NULL;
+    }
+    return true;
+}
+
+// Returns the number of instructions in the lines.
+static int count()
+{
+    int n = 0;
+    for(int i = 0; i < nlines; i++)
+        if(lines[i] && lines[i][0] == '\t' && strncmp(lines[i], "\tDB ", 4) != 0)
+            n++;
+    return n;
+}
+
+// Rewrites the output assembly with the peephole rules, giving the instruction counts
+// before and after.
+static void peephole(int* before, int* after)
+{
+    nlines = 0;
+    for(char* s = text; *s != '\0';)
+    {
+        char* const end = strchr(s, '\n');
+        *end = '\0';
+        lines = (char**) realloc(lines, (nlines + 1) * sizeof(*lines));
+        lines[nlines++] = dup(s);
+        s = end + 1;
+    }
+    *before = count();
+    for(bool changed = peeping; changed;)
+    {
+        changed = false;
+        for(int i = code(0); i < nlines; i = code(i + 1))
+            for(unsigned r = 0; r < sizeof(rules) / sizeof(*rules); r++)
+                if(lines[i] && rewrite(&rules[r], i))
+                    changed = true;
+    }
+    *after = count();
+    length = 0;
+    text[0] = '\0';
+    for(int i = 0; i < nlines; i++)
+        if(lines[i])
+        {
+            print("%s", lines[i]);
+            free(lines[i]);
+        }
+    free(lines);
+    lines = NULL;
+}
+
+// Compiles one c8 file to a ROM image, then writes the ROM and any dumps.
+static void compile(const char* path)
+{
+    struct label baked[] = {
+        { dup("draw"   ), 3, 0, NULL, NULL, 0, false },
+        { dup("putchar"), 3, 0, NULL, NULL, 0, false },
+        { dup("rand"   ), 0, 0, NULL, NULL, 0, false },
+        { dup("getchar"), 0, 0, NULL, NULL, 0, false },
+        { dup("cls"    ), 0, 0, NULL, NULL, 0, false },
+        { dup("sizeof" ), 1, 0, NULL, NULL, 0, false },
+        { dup("__mul"  ), 2, 0, NULL, NULL, 0, false },
+        { dup("__div"  ), 2, 0, NULL, NULL, 0, false },
+        { dup("__mod"  ), 2, 0, NULL, NULL, 0, false },
+        { dup("__shl"  ), 2, 0, NULL, NULL, 0, false },
+        { dup("__shr"  ), 2, 0, NULL, NULL, 0, false },
+    };
+    for(unsigned i = 0; i < sizeof(baked) / sizeof(*baked); i++)
+        labels[l++] = baked[i];
+    c8src = path;
+    fi = fopen(path, "r");
+    if(fi == NULL)
+    {
+        fprintf(stderr, "error: %s does not exist\n", c8src);
+        exit(1);
+    }
+    rom = sibling(path, ".bin");
+    nline = 1;
+    reads = 0;
+    branch = 0;
+    length = 0;
+    text[0] = '\0';
+    next();
+    skip();
+    program();
+    fclose(fi);
+    fi = NULL;
+    // Callees come first, so each is optimized before it is inlined.
+    for(int i = 0; i < l; i++)
+        if(labels[i].function)
+            optimize(labels[i].function);
+    for(int i = 0; i < l; i++)
+        if(labels[i].function)
+        {
+            outline(labels[i].function);
+            allocate(labels[i].function);
+        }
+    clobbers();
+    if(irlisting)
+    {
+        char* const irid = sibling(path, ".ir");
+        FILE* const fp = fopen(irid, "w");
+        if(fp == NULL)
+        {
+            fprintf(stderr, "error: %s cannot be made\n", irid);
+            exit(1);
+        }
+        listir(fp);
+        fclose(fp);
+        free(irid);
+    }
+    prune();
+    generate();
+    int before;
+    int after;
+    peephole(&before, &after);
+    if(hexing)
+    {
+        hexid = sibling(path, ".hex");
+        dump = fopen(hexid, "w");
+        if(dump == NULL)
+        {
+            fprintf(stderr, "error: %s cannot be made\n", hexid);
+            exit(1);
+        }
+    }
+    written = 0;
+    struct node* const nodes = translate(text);
+    save(rom, image, written);
+    if(reporting)
+        printf("%s: %d -> %d instructions, %d -> %d bytes\n", path, before, after, written + 2 * (before - after), written);
+    if(listing)
+    {
+        char* const assem = sibling(path, ".asm");
+        save(assem, text, length);
+        free(assem);
+    }
+    if(labeling)
+    {
+        char* const symid = sibling(path, ".sym");
+        symbols(nodes, symid);
+        free(symid);
+    }
+    burn(nodes);
+    if(dump)
+    {
+        fclose(dump);
+        dump = NULL;
+    }
+    free(hexid);
+    hexid = NULL;
+    free(rom);
+    rom = NULL;
+    reset();
+    kill();
+}
+
+// Rock and Roll, baby.
+// Compiles every c8 file given in one process, each to a .bin beside it.
+int main(int argc, char* argv[])
+{
+    int i = 1;
+    for(; i < argc && argv[i][0] == '-'; i++)
+    {
+        if(strcmp(argv[i], "-a") == 0)
+            listing = true;
+        else
+        if(strcmp(argv[i], "-x") == 0)
+            hexing = true;
+        else
+        if(strcmp(argv[i], "-s") == 0)
+            labeling = true;
+        else
+        if(strcmp(argv[i], "-i") == 0)
+            irlisting = true;
+        else
+        if(strcmp(argv[i], "-r") == 0)
+            reporting = true;
+        else
+        if(strcmp(argv[i], "-O0") == 0)
+        {
+            for(unsigned j = 0; j < sizeof(passes) / sizeof(*passes); j++)
+                passes[j].off = true;
+            peeping = false;
+            pruning = false;
+        }
+        else
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            off(argv[++i]);
+        else
+        {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            exit(1);
+        }
+    }
+    if(i == argc)
+    {
+        fprintf(stderr, "error: expected one or more input files\n");
+        exit(1);
+    }
+    init();
+    for(; i < argc; i++)
+        compile(argv[i]);
 }
@@ -1,6 +1,22 @@
+#define _POSIX_C_SOURCE 200809L
+
+#ifndef HEADLESS
 #include <SDL2/SDL.h>
+#endif
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <time.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define VERSION "1.0"
 
 #define VROWS (32)
 #define VCOLS (64)
@@ -9,6 +25,12 @@
 #define VSIZE (16)
 #define SSIZE (12)
 #define BFONT (80)
+#define CPF (15)
+
+#define QUIRK_SHIFT (0x1)
+#define QUIRK_MEMORY (0x2)
+#define QUIRK_JUMP (0x4)
+#define QUIRK_VF_RESET (0x8)
 
 static uint64_t vmem[VROWS];
 
@@ -22,39 +44,246 @@ static uint8_t st;
 static uint8_t sp;
 static uint8_t v[VSIZE];
 static uint8_t mem[BYTES];
-static uint8_t charges[VROWS][VCOLS];
 
-static const uint8_t* key;
+static uint32_t seed;
 
-static SDL_Window* window;
-static SDL_Renderer* renderer;
+// Predecoded handler (an index into flat[]) for every address. Zero decodes lazily.
+static uint8_t decodes[BYTES];
+static uint8_t* decoded = decodes;
+
+// Goes high while frames are being speculatively run ahead.
+static bool ahead;
+
+// Host calls through SYS 0x10N (-x).
+static bool hosting;
+
+// Everything needed to rewind the machine.
+struct state
+{
+    uint64_t vmem[VROWS];
+    uint16_t pc;
+    uint16_t I;
+    uint16_t s[SSIZE];
+    uint8_t dt;
+    uint8_t st;
+    uint8_t sp;
+    uint8_t v[VSIZE];
+    uint8_t mem[BYTES];
+    uint8_t decoded[BYTES];
+    uint32_t seed;
+};
+
+// Translation cache header, followed by the predecoded handler table.
+// Caches are keyed by a hash of the emulator version and ROM image.
+struct cache
+{
+    char magic[4];
+    uint32_t size;
+    uint64_t hash;
+};
+
+// Translation cache directory (-c dir).
+static const char* caches;
+
+// Instructions executed.
+static uint64_t ticks;
+
+// Always on counters, shown live in the window title (-o) or rewritten to a
+// JSON file once a second (-s file).
+static struct counters
+{
+    uint64_t draws;
+    uint64_t collisions;
+    uint64_t waits;
+    uint64_t underflows;
+    uint64_t presented;
+    uint64_t skipped;
+}
+counts;
+
+// Watched RAM ranges (-w lo:hi). RAM is split into 64 pages of 64 bytes and only
+// stores to pages with their bit set in 'watched' take the slow path.
+static struct watch
+{
+    uint16_t lo;
+    uint16_t hi;
+}
+watches[16];
+
+static int nwatches;
+
+static uint64_t watched;
+
+// Breakpoint addresses (-b addr).
+static bool breaks[BYTES];
+
+// Executed, read and written flags for every address (-v file).
+// The flags are merged into the file across runs.
+#define EXECUTED (0x1)
+#define READ (0x2)
+#define WRITTEN (0x4)
+
+static const char* coverage;
+
+static uint8_t covers[BYTES];
+
+static long romsize;
+
+// ROM fingerprint database (-d db). Built by romdb from roms.txt.
+static const char* database = "roms.db";
+
+// Database entries are found by open addressing on the ROM hash.
+struct fingerprint
+{
+    uint64_t hash;
+    uint16_t ipf;
+    uint8_t platform;
+    uint8_t quirks;
+    uint32_t unused;
+};
+
+struct fingerprints
+{
+    char magic[4];
+    uint32_t slots;
+};
+
+// Quirks from the fingerprint database (-q quirks). These select handler variants at decode time.
+static uint8_t quirks;
+
+// Instructions per frame. A known rate (-i ipf, or from the database) paces frames to 60 Hz
+// and ticks timers once per frame. Unknown ROMs run unpaced with timers ticking every cycle.
+static int ipf = CPF;
+
+static bool paced;
+
+// Held keys, one bit per key.
+static uint16_t keys;
+
+// Input to photon latency (-l file). The latest key press is followed through the
+// first instruction that reads it, the DXYN after that, and the present that shows it.
+// Spans are kept in histograms of power of two microseconds.
+enum { IDLE, PRESSED, NOTICED, DRAWN, SHOWN };
+
+enum { TOTAL, READING, DRAWING, PRESENTING, FRAMING, SPANS };
+
+static int stage;
+
+static int chased;
+
+static uint64_t stamps[SHOWN + 1];
+
+static uint64_t spans[SPANS][32];
+
+static const char* const spanning[SPANS] = { "press-present", "press-read", "read-draw", "draw-present", "frame" };
+
+static uint64_t nanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void span(const int at, const uint64_t ns)
+{
+    int bucket = 0;
+    for(uint64_t us = ns / 1000; us > 0 && bucket < 31; us >>= 1)
+        bucket++;
+    spans[at][bucket]++;
+}
+
+static void mark(const int next)
+{
+    stamps[next] = nanos();
+    stage = next;
+    if(next == SHOWN)
+    {
+        span(TOTAL, stamps[SHOWN] - stamps[PRESSED]);
+        span(READING, stamps[NOTICED] - stamps[PRESSED]);
+        span(DRAWING, stamps[DRAWN] - stamps[NOTICED]);
+        span(PRESENTING, stamps[SHOWN] - stamps[DRAWN]);
+        stage = IDLE;
+    }
+}
 
-static int input(const int waiting)
-{
-    do
-    {
-        SDL_PumpEvents();
-        if(key[SDL_SCANCODE_1]) return 0x01;
-        if(key[SDL_SCANCODE_2]) return 0x02;
-        if(key[SDL_SCANCODE_3]) return 0x03;
-        if(key[SDL_SCANCODE_4]) return 0x0C;
-        if(key[SDL_SCANCODE_Q]) return 0x04;
-        if(key[SDL_SCANCODE_W]) return 0x05;
-        if(key[SDL_SCANCODE_E]) return 0x06;
-        if(key[SDL_SCANCODE_R]) return 0x0D;
-        if(key[SDL_SCANCODE_A]) return 0x07;
-        if(key[SDL_SCANCODE_S]) return 0x08;
-        if(key[SDL_SCANCODE_D]) return 0x09;
-        if(key[SDL_SCANCODE_F]) return 0x0E;
-        if(key[SDL_SCANCODE_Z]) return 0x0A;
-        if(key[SDL_SCANCODE_X]) return 0x00;
-        if(key[SDL_SCANCODE_C]) return 0x0B;
-        if(key[SDL_SCANCODE_V]) return 0x0F;
-    }
-    while(waiting);
+// Returns the first held key, or -1 if none is held.
+static int input()
+{
+    // Keys are reported in the order the keyboard is laid out.
+    static const uint8_t order[] = { 0x1, 0x2, 0x3, 0xC, 0x4, 0x5, 0x6, 0xD, 0x7, 0x8, 0x9, 0xE, 0xA, 0x0, 0xB, 0xF };
+    for(unsigned i = 0; i < sizeof(order); i++)
+        if((keys >> order[i]) & 0x1)
+        {
+            if(stage == PRESSED && order[i] == chased)
+                mark(NOTICED);
+            return order[i];
+        }
     return -1;
 }
 
+// Xorshift. Kept with the machine state so that a rewind replays the same numbers.
+static uint8_t rnd()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// Marks the instructions overlapping 'n' stored bytes at 'at' for decoding.
+static void stale(const uint16_t at, const int n)
+{
+    for(int i = -1; i < n; i++)
+        decoded[(at + i) & 0x0FFF] = 0;
+}
+
+// Logs stores that land in a watched range.
+static void watch(const uint16_t at, const int n)
+{
+    for(int i = 0; i < n; i++)
+    {
+        const uint16_t a = (at + i) & 0x0FFF;
+        for(int w = 0; w < nwatches; w++)
+            if(a >= watches[w].lo && a <= watches[w].hi)
+                fprintf(stderr, "watch: pc 0x%03X stored 0x%02X at 0x%03X on cycle %" PRIu64 "\n",
+                    (pc - 0x0002) & 0x0FFF, mem[a], a, ticks);
+    }
+}
+
+// Frames run ahead are rewound, so only what really runs is covered.
+static void cover(const uint16_t at, const int n, const uint8_t flag)
+{
+    if(ahead)
+        return;
+    for(int i = 0; i < n; i++)
+        covers[(at + i) & 0x0FFF] |= flag;
+}
+
+// Called before 'n' bytes are loaded from 'at'.
+static void loading(const uint16_t at, const int n)
+{
+    if(coverage)
+        cover(at, n, READ);
+}
+
+// Called after 'n' bytes are stored at 'at'.
+static void stored(const uint16_t at, const int n)
+{
+    stale(at, n);
+    if(coverage)
+        cover(at, n, WRITTEN);
+    // Stores run ahead are rewound, and reported once they really happen.
+    if(watched && !ahead)
+    {
+        uint64_t pages = 0;
+        for(int i = 0; i < n; i += 64)
+            pages |= 1ull << (((at + i) & 0x0FFF) >> 6);
+        pages |= 1ull << (((at + n - 1) & 0x0FFF) >> 6);
+        if(pages & watched)
+            watch(at, n);
+    }
+}
+
 static void _0000() { /* no-op */ }
 static void _00E0() { for(int j = 0; j < VROWS; j++) while(vmem[j] >>= 1); }
 static void _00EE() { pc = s[--sp]; }
@@ -74,29 +303,46 @@ static void _8XY5() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; u
 static void _8XY7() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; uint8_t flag = v[y] - v[x] < 0x00 ? 0x00 : 0x01; v[x] = v[y] - v[x]; v[0xF] = flag; }
 static void _8XY6() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; uint8_t flag = (v[y] >> 0) & 0x01; v[x] = v[y] >> 1; v[0xF] = flag; }
 static void _8XYE() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; uint8_t flag = (v[y] >> 7) & 0x01; v[x] = v[y] << 1; v[0xF] = flag; }
+static void _8XY1q() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; v[x] |= v[y]; v[0xF] = 0; }
+static void _8XY2q() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; v[x] &= v[y]; v[0xF] = 0; }
+static void _8XY3q() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; v[x] ^= v[y]; v[0xF] = 0; }
+static void _8XY6q() { uint16_t x = (op & 0x0F00) >> 8; uint8_t flag = (v[x] >> 0) & 0x01; v[x] = v[x] >> 1; v[0xF] = flag; }
+static void _8XYEq() { uint16_t x = (op & 0x0F00) >> 8; uint8_t flag = (v[x] >> 7) & 0x01; v[x] = v[x] << 1; v[0xF] = flag; }
 static void _9XY0() { uint16_t x = (op & 0x0F00) >> 8, y = (op & 0x00F0) >> 4; if(v[x] != v[y]) pc += 0x0002; }
 static void _ANNN() { uint16_t nnn = op & 0x0FFF; I = nnn; }
 static void _BNNN() { uint16_t nnn = op & 0x0FFF; pc = nnn + v[0x0]; }
-static void _CXNN() { uint16_t x = (op & 0x0F00) >> 8, nn = op & 0x00FF; v[x] = nn & (rand() % 0x100); }
-static void _DXYN() {
-    uint16_t x = (op & 0x0F00) >> 8;
-    uint16_t y = (op & 0x00F0) >> 4;
-    uint16_t n = (op & 0x000F) >> 0;
+static void _BXNNq() { uint16_t x = (op & 0x0F00) >> 8, nnn = op & 0x0FFF; pc = nnn + v[x]; }
+static void _CXNN() { uint16_t x = (op & 0x0F00) >> 8, nn = op & 0x00FF; v[x] = nn & rnd(); }
+static uint8_t sprite(const uint8_t x, const uint8_t y, const uint16_t at, const int n)
+{
     uint8_t flag = 0;
+    loading(at, n);
     for(int j = 0; j < n; j++)
     {
-        uint64_t line = (uint64_t) mem[I + j] << (VCOLS - 8);
-        line >>= v[x];
-        if((vmem[v[y] + j] ^ line) != (vmem[v[y] + j] | line))
+        uint64_t line = (uint64_t) mem[at + j] << (VCOLS - 8);
+        line >>= x;
+        if((vmem[y + j] ^ line) != (vmem[y + j] | line))
             flag = 1;
-        vmem[v[y] + j] ^= line;
+        vmem[y + j] ^= line;
     }
-    v[0xF] = flag;
+    return flag;
+}
+static void _DXYN() {
+    uint16_t x = (op & 0x0F00) >> 8;
+    uint16_t y = (op & 0x00F0) >> 4;
+    uint16_t n = (op & 0x000F) >> 0;
+    v[0xF] = sprite(v[x], v[y], I, n);
+    counts.draws++;
+    counts.collisions += v[0xF];
+    if(stage == NOTICED)
+        mark(DRAWN);
 }
-static void _EXA1() { uint16_t x = (op & 0x0F00) >> 8; if(v[x] != input(0)) pc += 0x0002; }
-static void _EX9E() { uint16_t x = (op & 0x0F00) >> 8; if(v[x] == input(0)) pc += 0x0002; }
+static void _EXA1() { uint16_t x = (op & 0x0F00) >> 8; if(v[x] != input()) pc += 0x0002; }
+static void _EX9E() { uint16_t x = (op & 0x0F00) >> 8; if(v[x] == input()) pc += 0x0002; }
 static void _FX07() { uint16_t x = (op & 0x0F00) >> 8; v[x] = dt; }
-static void _FX0A() { uint16_t x = (op & 0x0F00) >> 8; v[x] = input(1); }
+// Waits by running again each cycle until a key is held, so the front end keeps scanning,
+// presenting and tallying meanwhile.
+static void _FX0A() { uint16_t x = (op & 0x0F00) >> 8; const int k = input(); if(k == -1) { pc -= 0x0002; counts.waits++; } else v[x] = k; }
 static void _FX15() { uint16_t x = (op & 0x0F00) >> 8; dt = v[x]; }
 static void _FX18() { uint16_t x = (op & 0x0F00) >> 8; st = v[x]; }
 static void _FX1E() { uint16_t x = (op & 0x0F00) >> 8; I += v[x]; }
@@ -105,9 +351,48 @@ static void _FX33() { uint16_t x = (op & 0x0F00) >> 8;
     const int lookup[] = { 100, 10, 1 };
     for(unsigned i = 0; i < sizeof(lookup) / sizeof(*lookup); i++)
         mem[I + i] = v[x] / lookup[i] % 10;
+    stored(I, 3);
+}
+static void _FX55() { uint16_t x = (op & 0x0F00) >> 8; int i; for(i = 0; i <= x; i++) mem[I + i] = v[i]; stored(I, i); I += i; }
+static void _FX65() { uint16_t x = (op & 0x0F00) >> 8; int i; loading(I, x + 1); for(i = 0; i <= x; i++) v[i] = mem[I + i]; I += i; }
+static void _FX55q() { uint16_t x = (op & 0x0F00) >> 8; for(int i = 0; i <= x; i++) mem[I + i] = v[i]; stored(I, x + 1); }
+static void _FX65q() { uint16_t x = (op & 0x0F00) >> 8; loading(I, x + 1); for(int i = 0; i <= x; i++) v[i] = mem[I + i]; }
+
+// Host calls (SYS 0x10N) run native routines in place of long CHIP-8 loops.
+// Arguments are passed in V0-V3 and I. Results are returned in VF (and V0).
+static void _0101() { /* MEMSET: V1 bytes at I set to V0 */
+    for(int i = 0; i < v[0x1]; i++) mem[(I + i) & 0x0FFF] = v[0x0];
+    stored(I, v[0x1]);
+}
+static void _0102() { /* MEMCPY: V2 bytes from address V0:V1 copied to I */
+    uint8_t buf[0x100];
+    uint16_t from = (v[0x0] << 8 | v[0x1]) & 0x0FFF;
+    loading(from, v[0x2]);
+    for(int i = 0; i < v[0x2]; i++) buf[i] = mem[(from + i) & 0x0FFF];
+    for(int i = 0; i < v[0x2]; i++) mem[(I + i) & 0x0FFF] = buf[i];
+    stored(I, v[0x2]);
+}
+static void _0103() { /* MUL: VF = lo(V0 * V1), V0 = hi(V0 * V1) */
+    uint16_t p = v[0x0] * v[0x1]; v[0xF] = p & 0xFF; v[0x0] = p >> 8;
+}
+static void _0104() { /* DIV: VF = V0 / V1, V0 = V0 % V1. VF = 0xFF on divide by zero */
+    if(v[0x1] == 0) { v[0xF] = 0xFF; return; }
+    uint8_t q = v[0x0] / v[0x1]; v[0x0] %= v[0x1]; v[0xF] = q;
+}
+static void _0105() { /* BCD: Draws V2 as three decimal digits at V0, V1. VF = collision */
+    const int lookup[] = { 100, 10, 1 };
+    uint8_t flag = 0;
+    for(unsigned i = 0; i < sizeof(lookup) / sizeof(*lookup); i++)
+        if(v[0x0] + 5 * i < VCOLS)
+            flag |= sprite(v[0x0] + 5 * i, v[0x1], 5 * (v[0x2] / lookup[i] % 10), 5);
+    v[0xF] = flag;
+}
+static void _0106() { /* BLIT: V2 sprites of V3 rows at I drawn left to right from V0, V1. VF = collision */
+    uint8_t flag = 0;
+    for(int i = 0; i < v[0x2] && v[0x0] + 8 * i < VCOLS; i++)
+        flag |= sprite(v[0x0] + 8 * i, v[0x1], I + v[0x3] * i, v[0x3]);
+    v[0xF] = flag;
 }
-static void _FX55() { uint16_t x = (op & 0x0F00) >> 8; int i; for(i = 0; i <= x; i++) mem[I + i] = v[i]; I += i; }
-static void _FX65() { uint16_t x = (op & 0x0F00) >> 8; int i; for(i = 0; i <= x; i++) v[i] = mem[I + i]; I += i; }
 
 static void _0___();
 static void _8___();
@@ -124,12 +409,165 @@ static void (*opsd[])() = { _0000, _0000, _0000, _0000, _0000, _0000, _0000, _FX
 /*                       */ _0000, _0000, _0000, _0000, _0000, _FX55, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000,
 /*                       */ _0000, _0000, _0000, _0000, _0000, _FX65, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000,
 /*************************/ _0000, _0000, _0000, _0000, _0000, _FX65, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000 };
+static void (*host[])() = { _0000, _0101, _0102, _0103, _0104, _0105, _0106, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000, _0000 };
 static void (*exec[])() = { _0___, _1NNN, _2NNN, _3XNN, _4XNN, _5XY0, _6XNN, _7XNN, _8___, _9XY0, _ANNN, _BNNN, _CXNN, _DXYN, _E___, _F___ };
-static void _0___() { (*opsa[op & 0x000F])(); }
+static void _0___() { hosting && (op & 0x0FF0) == 0x0100 ? (*host[op & 0x000F])() : (*opsa[op & 0x000F])(); }
 static void _8___() { (*opsb[op & 0x000F])(); }
 static void _E___() { (*opsc[op & 0x000F])(); }
 static void _F___() { (*opsd[op & 0x00FF])(); }
 
+// Predecoded instructions skip the second table hop of exec[].
+static void ______();
+static void _TRAP();
+static void (*flat[])() = {
+    ______, _0000, _0___, _1NNN, _2NNN, _3XNN, _4XNN, _5XY0, _6XNN, _7XNN,
+    _8XY0, _8XY1, _8XY2, _8XY3, _8XY4, _8XY5, _8XY6, _8XY7, _8XYE, _9XY0,
+    _ANNN, _BNNN, _CXNN, _DXYN, _EXA1, _EX9E, _FX07, _FX0A, _FX15, _FX18,
+    _FX1E, _FX29, _FX33, _FX55, _FX65, _8XY1q, _8XY2q, _8XY3q, _8XY6q, _8XYEq,
+    _BXNNq, _FX55q, _FX65q, _TRAP,
+};
+
+static const uint8_t trap = sizeof(flat) / sizeof(*flat) - 1;
+
+static uint8_t decode(const uint16_t o)
+{
+    void (*f)() = exec[o >> 12];
+    if(f == _8___) f = opsb[o & 0x000F];
+    if(f == _E___) f = opsc[o & 0x000F];
+    // Data decodes too, so FX opcodes past the end of the table are no-ops.
+    if(f == _F___) f = (o & 0x00FF) < sizeof(opsd) / sizeof(*opsd) ? opsd[o & 0x00FF] : _0000;
+    if(quirks & QUIRK_SHIFT)
+    {
+        if(f == _8XY6) f = _8XY6q;
+        if(f == _8XYE) f = _8XYEq;
+    }
+    if(quirks & QUIRK_MEMORY)
+    {
+        if(f == _FX55) f = _FX55q;
+        if(f == _FX65) f = _FX65q;
+    }
+    if(quirks & QUIRK_VF_RESET)
+    {
+        if(f == _8XY1) f = _8XY1q;
+        if(f == _8XY2) f = _8XY2q;
+        if(f == _8XY3) f = _8XY3q;
+    }
+    if(quirks & QUIRK_JUMP)
+        if(f == _BNNN) f = _BXNNq;
+    for(unsigned i = 1; i < trap; i++)
+        if(flat[i] == f)
+            return i;
+    return 1;
+}
+
+// Decodes on first execution.
+static void ______()
+{
+    const uint16_t at = (pc - 0x0002) & 0x0FFF;
+    cover(at, 2, EXECUTED);
+    decoded[at] = breaks[at] ? trap : decode(op);
+    (*flat[decoded[at]])();
+}
+
+static uint64_t fnv(const void* const bytes, const size_t size, uint64_t h)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        h ^= ((const uint8_t*) bytes)[i];
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+
+// Looks up the loaded ROM in the fingerprint database, selecting its quirks and speed.
+static void fingerprint(const long size)
+{
+    const int fd = open(database, O_RDONLY);
+    if(fd == -1)
+        return;
+    struct stat info;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(struct fingerprints))
+        map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return;
+    const struct fingerprints* const db = (struct fingerprints*) map;
+    const struct fingerprint* const slots = (struct fingerprint*) (db + 1);
+    const uint32_t n = db->slots;
+    if(memcmp(db->magic, "ROM", 4) == 0
+    && n > 0 && (n & (n - 1)) == 0
+    && (size_t) info.st_size == sizeof(*db) + n * sizeof(*slots))
+    {
+        const uint64_t hash = fnv(&mem[START], size, 0xCBF29CE484222325);
+        for(uint32_t i = hash & (n - 1); slots[i].hash; i = (i + 1) & (n - 1))
+            if(slots[i].hash == hash)
+            {
+                if(slots[i].platform != 0)
+                    fprintf(stderr, "warning: platform %d not supported; running as chip8\n", slots[i].platform);
+                quirks = slots[i].quirks;
+                if(slots[i].ipf)
+                {
+                    ipf = slots[i].ipf;
+                    paced = true;
+                }
+                break;
+            }
+    }
+    munmap(map, info.st_size);
+}
+
+// Maps the translation cache for the loaded ROM, building it first if missing or stale.
+static void translate(const long size)
+{
+    // The handler table layout is part of the key, so caches of another build are not reused.
+    const size_t layout = sizeof(flat);
+    uint64_t hash = fnv(VERSION, sizeof(VERSION), 0xCBF29CE484222325);
+    hash = fnv(&layout, sizeof(layout), hash);
+    hash = fnv(&quirks, sizeof(quirks), hash);
+    hash = fnv(&mem[START], size, hash);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 ".emu", caches, hash);
+    const size_t bytes = sizeof(struct cache) + BYTES;
+    const int fd = open(path, O_RDONLY);
+    if(fd != -1)
+    {
+        struct stat info;
+        void* map = MAP_FAILED;
+        if(fstat(fd, &info) == 0 && (size_t) info.st_size == bytes)
+            map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(map != MAP_FAILED)
+        {
+            const struct cache* const c = (struct cache*) map;
+            uint8_t* const table = (uint8_t*) map + sizeof(struct cache);
+            // Every entry indexes flat[], so a damaged cache is decoded afresh.
+            bool valid = memcmp(c->magic, "EMU", 4) == 0 && c->size == size && c->hash == hash;
+            for(int i = 0; valid && i < BYTES; i++)
+                valid = table[i] < trap;
+            if(valid)
+            {
+                decoded = table;
+                return;
+            }
+            munmap(map, bytes);
+        }
+    }
+    for(int i = 0; i < BYTES; i++)
+        decodes[i] = decode((mem[i] << 8) + mem[(i + 1) & 0x0FFF]);
+    // Written aside then renamed so that concurrent launches never see a partial cache.
+    const struct cache c = { "EMU", size, hash };
+    char temp[4096 + 16];
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+    mkdir(caches, 0755);
+    FILE* const fp = fopen(temp, "wb");
+    if(fp == NULL)
+        return;
+    const bool written = fwrite(&c, sizeof(c), 1, fp) == 1 && fwrite(decodes, BYTES, 1, fp) == 1;
+    fclose(fp);
+    written ? rename(temp, path) : remove(temp);
+}
+
 static void load(const char* game)
 {
     const uint8_t ch[BFONT] = {
@@ -166,19 +604,174 @@ static void load(const char* game)
         mem[i] = ch[i];
     for(int i = 0; i < size; i++)
         mem[i + START] = buf[i];
+    romsize = size;
+    if(database)
+        fingerprint(size);
+    // Coverage marks executed instructions as they are lazily decoded,
+    // which a prebuilt cache would skip.
+    if(caches && !coverage)
+        translate(size);
+    for(int i = 0; i < BYTES; i++)
+        if(breaks[i])
+            decoded[i] = trap;
 }
 
-static void cycle()
+static void timers()
 {
+    if(dt == 1 || st == 1)
+        counts.underflows++;
     if(dt > 0) dt--;
     if(st > 0) st--;
     if(st)
     {
         /* Beep */
     }
-    op = (mem[pc] << 8) + (mem[pc + 1] & 0x00FF);
-    pc += 0x0002;
-    (*exec[op >> 12])();
+}
+
+static void cycle()
+{
+    if(!paced)
+        timers();
+    // Running off the end of memory wraps, so the decode is always one of flat[].
+    const uint16_t at = pc & 0x0FFF;
+    op = (mem[at] << 8) + (mem[(at + 1) & 0x0FFF] & 0x00FF);
+    const uint8_t d = decoded[at];
+    pc = at + 0x0002;
+    (*flat[d])();
+    ticks++;
+}
+
+static void save(struct state* const to)
+{
+    memcpy(to->vmem, vmem, sizeof(vmem));
+    memcpy(to->s, s, sizeof(s));
+    memcpy(to->v, v, sizeof(v));
+    memcpy(to->mem, mem, sizeof(mem));
+    memcpy(to->decoded, decoded, BYTES);
+    to->pc = pc;
+    to->I = I;
+    to->dt = dt;
+    to->st = st;
+    to->sp = sp;
+    to->seed = seed;
+}
+
+static void restore(const struct state* const from)
+{
+    memcpy(vmem, from->vmem, sizeof(vmem));
+    memcpy(s, from->s, sizeof(s));
+    memcpy(v, from->v, sizeof(v));
+    memcpy(mem, from->mem, sizeof(mem));
+    memcpy(decoded, from->decoded, BYTES);
+    pc = from->pc;
+    I = from->I;
+    dt = from->dt;
+    st = from->st;
+    sp = from->sp;
+    seed = from->seed;
+}
+
+static void dump()
+{
+    for(int i = 0; i < VSIZE; i++)
+        printf("v[%02d]: %d = 0x%02X\n", i, v[i], v[i]);
+}
+
+static void brk()
+{
+    fprintf(stderr, "break: pc 0x%03X on cycle %" PRIu64 "\n", (pc - 0x0002) & 0x0FFF, ticks);
+    dump();
+}
+
+// Runs when a breakpoint is hit. Replace to attach a debugger.
+static void (*debugger)() = brk;
+
+// Breakpoints are patched over the predecoded instruction rather than RAM,
+// so the program still reads its own bytes and nothing is checked per cycle.
+static void _TRAP()
+{
+    // An FX0A waiting for a key reruns in place, and breaks only when first reached.
+    static bool rerun;
+    const uint16_t at = pc - 0x0002;
+    cover(at, 2, EXECUTED);
+    if(!ahead && !rerun)
+        (*debugger)();
+    (*flat[decode(op)])();
+    if(!ahead)
+        rerun = pc == at;
+}
+
+#ifndef HEADLESS
+
+static uint8_t charges[VROWS][VCOLS];
+
+// Frames to run ahead (-a frames).
+static int frames;
+
+// Cycles to run without a window (-n cycles).
+static long headless;
+
+// Cycles to boot before forking a child per test case (-f cycles).
+static long forks;
+
+// Display and registers published to POSIX shared memory (-m name) once a frame.
+// Writes are bracketed by a sequence that is odd while writing. Readers retry when
+// it is odd or changes under them, so emu never waits on a reader.
+struct shared
+{
+    uint32_t sequence;
+    uint32_t unused;
+    uint64_t frame;
+    uint64_t vmem[VROWS];
+    uint16_t pc;
+    uint16_t I;
+    uint8_t v[VSIZE];
+    uint8_t dt;
+    uint8_t st;
+    uint8_t sp;
+};
+
+static const char* sharing;
+
+static struct shared* shared;
+
+// Latency histogram file (-l file).
+static const char* latencies;
+
+static const uint8_t* key;
+
+static SDL_Window* window;
+static SDL_Renderer* renderer;
+
+static bool scan()
+{
+    if(headless)
+        return false;
+    SDL_PumpEvents(); // Cannot poll an SDL_Event -- Too slow!
+    const uint16_t held = keys;
+    keys = key[SDL_SCANCODE_X] << 0x0
+         | key[SDL_SCANCODE_1] << 0x1
+         | key[SDL_SCANCODE_2] << 0x2
+         | key[SDL_SCANCODE_3] << 0x3
+         | key[SDL_SCANCODE_Q] << 0x4
+         | key[SDL_SCANCODE_W] << 0x5
+         | key[SDL_SCANCODE_E] << 0x6
+         | key[SDL_SCANCODE_A] << 0x7
+         | key[SDL_SCANCODE_S] << 0x8
+         | key[SDL_SCANCODE_D] << 0x9
+         | key[SDL_SCANCODE_Z] << 0xA
+         | key[SDL_SCANCODE_C] << 0xB
+         | key[SDL_SCANCODE_4] << 0xC
+         | key[SDL_SCANCODE_R] << 0xD
+         | key[SDL_SCANCODE_F] << 0xE
+         | key[SDL_SCANCODE_V] << 0xF;
+    const uint16_t down = keys & ~held;
+    if(latencies && down)
+    {
+        chased = __builtin_ctz(down);
+        mark(PRESSED);
+    }
+    return !key[SDL_SCANCODE_END] && !key[SDL_SCANCODE_ESCAPE];
 }
 
 static void output()
@@ -192,6 +785,17 @@ static void output()
         SDL_RenderFillRect(renderer, &rect);
     }
     SDL_RenderPresent(renderer);
+    counts.presented++;
+    if(latencies)
+    {
+        static uint64_t last;
+        const uint64_t t = nanos();
+        if(last)
+            span(FRAMING, t - last);
+        last = t;
+        if(stage == DRAWN)
+            mark(SHOWN);
+    }
 }
 
 static int charging(const int j, const int i)
@@ -215,38 +819,365 @@ static void discharge()
             charges[j][i] *= 0.997;
 }
 
-void dump()
+// Presents the frame that is 'frames' frames in the future given the keys held now,
+// then rewinds. Input shows up on screen that many frames sooner.
+static void runahead()
 {
-    for(int i = 0; i < VSIZE; i++)
-        printf("v[%02d]: %d = 0x%02X\n", i, v[i], v[i]);
+    static struct state now;
+    static uint8_t glow[VROWS][VCOLS];
+    const struct counters counted = counts;
+    const uint64_t ticked = ticks;
+    save(&now);
+    memcpy(glow, charges, sizeof(charges));
+    ahead = true;
+    for(int i = 1; i <= frames * ipf; i++)
+    {
+        cycle();
+        if(paced && i % ipf == 0)
+            timers();
+    }
+    ahead = false;
+    // Speculative frames are rewound, and so are their counts.
+    counts = counted;
+    ticks = ticked;
+    charge();
+    output();
+    memcpy(charges, glow, sizeof(charges));
+    restore(&now);
 }
 
-int main(int argc, char* argv[])
+// Holds frames to 60 Hz. Timers tick once per frame.
+static void pace()
+{
+    static uint64_t next;
+    const uint64_t hz = SDL_GetPerformanceFrequency();
+    const uint64_t now = SDL_GetPerformanceCounter();
+    timers();
+    // Catches up rather than racing after a stall.
+    if(next == 0 || now > next + hz / 10)
+    {
+        if(next)
+            counts.skipped += (now - next) / (hz / 60);
+        next = now;
+    }
+    next += hz / 60;
+    if(next > now)
+        SDL_Delay((next - now) * 1000 / hz);
+}
+
+// Writes the coverage of every ROM address, one per line, as: 0x202 xr-
+static void export()
 {
-    if(argc != 2)
+    FILE* fp = fopen(coverage, "r");
+    if(fp)
+    {
+        unsigned at;
+        char flags[4];
+        while(fscanf(fp, "%x %3s", &at, flags) == 2)
+            if(at < BYTES)
+                covers[at] |= (flags[0] == 'x' ? EXECUTED : 0)
+                            | (flags[1] == 'r' ? READ : 0)
+                            | (flags[2] == 'w' ? WRITTEN : 0);
+        fclose(fp);
+    }
+    fp = fopen(coverage, "w");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "error: %s cannot be made\n", coverage);
+        exit(1);
+    }
+    for(int i = START; i < START + romsize; i++)
+        fprintf(fp, "0x%03X %c%c%c\n", i,
+            covers[i] & EXECUTED ? 'x' : '-',
+            covers[i] & READ ? 'r' : '-',
+            covers[i] & WRITTEN ? 'w' : '-');
+    fclose(fp);
+}
+
+static const char* stats;
+
+static bool overlay;
+
+// Once a second, shows the counters in the window title and rewrites the stats file.
+// The file is replaced whole so a reader never sees half of it.
+static void tally(const bool now)
+{
+    static uint32_t last;
+    static struct counters then;
+    static uint64_t ticked;
+    const uint32_t ms = SDL_GetTicks();
+    if(!now && ms - last < 1000)
+        return;
+    last = ms;
+    const uint64_t shown = counts.presented - then.presented;
+    const double ipfs = shown ? (double) (ticks - ticked) / shown : 0.0;
+    const double dpfs = shown ? (double) (counts.draws - then.draws) / shown : 0.0;
+    then = counts;
+    ticked = ticks;
+    if(overlay && !headless)
+    {
+        char title[160];
+        snprintf(title, sizeof(title), "Emu-" VERSION " %" PRIu64 " fps %.0f ipf %.1f dpf %" PRIu64 " waits %" PRIu64 " skipped",
+            shown, ipfs, dpfs, counts.waits, counts.skipped);
+        SDL_SetWindowTitle(window, title);
+    }
+    if(stats)
+    {
+        char temp[512];
+        snprintf(temp, sizeof(temp), "%s.tmp", stats);
+        FILE* const fp = fopen(temp, "w");
+        if(fp == NULL)
+        {
+            fprintf(stderr, "error: %s cannot be made\n", temp);
+            exit(1);
+        }
+        fprintf(fp, "{\"instructions\": %" PRIu64 ", \"instructions_per_frame\": %.1f, \"draws\": %" PRIu64 ", \"draws_per_frame\": %.2f, "
+            "\"collisions\": %" PRIu64 ", \"waits\": %" PRIu64 ", \"underflows\": %" PRIu64 ", \"presented\": %" PRIu64 ", \"skipped\": %" PRIu64 "}\n",
+            ticks, ipfs, counts.draws, dpfs, counts.collisions, counts.waits, counts.underflows, counts.presented, counts.skipped);
+        fclose(fp);
+        rename(temp, stats);
+    }
+}
+
+// Writes every latency histogram bucket that was hit, one per line, as: read-draw 512us 40
+static void report()
+{
+    FILE* const fp = fopen(latencies, "w");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "error: %s cannot be made\n", latencies);
+        exit(1);
+    }
+    for(int i = 0; i < SPANS; i++)
+    for(int b = 0; b < 32; b++)
+        if(spans[i][b])
+            fprintf(fp, "%s %" PRIu64 "us %" PRIu64 "\n", spanning[i], b ? (uint64_t) 1 << (b - 1) : 0, spans[i][b]);
+    fclose(fp);
+}
+
+static void options(int argc, char* argv[])
+{
+    if(argc < 2)
     {
         fprintf(stderr, "error: too few or too many argmuents\n");
         exit(1);
     }
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_CreateWindowAndRenderer(512, 256, 0, &window, &renderer);
-    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0x00);
-    SDL_SetWindowTitle(window, "Emu-1.0");
-    SDL_RenderClear(renderer);
-    SDL_RenderPresent(renderer);
-    key = SDL_GetKeyboardState(NULL);
-    load(argv[1]);
-    srand(time(0));
-    for(int cycles = 0; !key[SDL_SCANCODE_END] && !key[SDL_SCANCODE_ESCAPE]; cycles++)
+    for(int i = 1; i < argc - 1; i++)
+    {
+        if(strcmp(argv[i], "-a") == 0 && i + 1 < argc - 1)
+            frames = atoi(argv[++i]);
+        else
+        if(strcmp(argv[i], "-x") == 0)
+            hosting = true;
+        else
+        if(strcmp(argv[i], "-c") == 0 && i + 1 < argc - 1)
+            caches = argv[++i];
+        else
+        if(strcmp(argv[i], "-w") == 0 && i + 1 < argc - 1 && nwatches < 16)
+        {
+            struct watch w;
+            char* end;
+            w.lo = strtoul(argv[++i], &end, 0) & 0x0FFF;
+            w.hi = *end == ':' ? strtoul(end + 1, NULL, 0) & 0x0FFF : w.lo;
+            for(int page = w.lo >> 6; page <= w.hi >> 6; page++)
+                watched |= 1ull << page;
+            watches[nwatches++] = w;
+        }
+        else
+        if(strcmp(argv[i], "-b") == 0 && i + 1 < argc - 1)
+            breaks[strtoul(argv[++i], NULL, 0) & 0x0FFF] = true;
+        else
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc - 1)
+            headless = atol(argv[++i]);
+        else
+        if(strcmp(argv[i], "-m") == 0 && i + 1 < argc - 1)
+            sharing = argv[++i];
+        else
+        if(strcmp(argv[i], "-f") == 0 && i + 1 < argc - 1)
+            forks = atol(argv[++i]);
+        else
+        if(strcmp(argv[i], "-v") == 0 && i + 1 < argc - 1)
+            coverage = argv[++i];
+        else
+        if(strcmp(argv[i], "-o") == 0)
+            overlay = true;
+        else
+        if(strcmp(argv[i], "-s") == 0 && i + 1 < argc - 1)
+            stats = argv[++i];
+        else
+        if(strcmp(argv[i], "-l") == 0 && i + 1 < argc - 1)
+            latencies = argv[++i];
+        else
+        if(strcmp(argv[i], "-d") == 0 && i + 1 < argc - 1)
+            database = argv[++i];
+        // Quirks and speed given by hand skip the database.
+        else
+        if(strcmp(argv[i], "-q") == 0 && i + 1 < argc - 1)
+        {
+            quirks = strtoul(argv[++i], NULL, 0);
+            database = NULL;
+        }
+        else
+        if(strcmp(argv[i], "-i") == 0 && i + 1 < argc - 1)
+        {
+            ipf = atoi(argv[++i]);
+            paced = ipf > 0;
+            ipf = paced ? ipf : CPF;
+            database = NULL;
+        }
+        else
+        {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            exit(1);
+        }
+    }
+}
+
+static void share()
+{
+    const int fd = shm_open(sharing, O_RDWR | O_CREAT, 0644);
+    if(fd == -1 || ftruncate(fd, sizeof(*shared)) == -1)
+    {
+        fprintf(stderr, "error: shared memory %s cannot be made\n", sharing);
+        exit(1);
+    }
+    shared = (struct shared*) mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shared == MAP_FAILED)
+    {
+        fprintf(stderr, "error: shared memory %s cannot be mapped\n", sharing);
+        exit(1);
+    }
+    // A segment left by an earlier run keeps its contents, and an odd sequence would stall readers.
+    memset(shared, 0, sizeof(*shared));
+}
+
+static void publish()
+{
+    __atomic_store_n(&shared->sequence, shared->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shared->frame++;
+    memcpy(shared->vmem, vmem, sizeof(vmem));
+    memcpy(shared->v, v, sizeof(v));
+    shared->pc = pc;
+    shared->I = I;
+    shared->dt = dt;
+    shared->st = st;
+    shared->sp = sp;
+    __atomic_store_n(&shared->sequence, shared->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Runs without a window. Timers tick once per frame when paced.
+static void run(const long cycles)
+{
+    for(long c = 1; c <= cycles; c++)
     {
-        SDL_PumpEvents(); // Cannot poll an SDL_Event -- Too slow!
-        charge();
         cycle();
-        if(cycles % 15 == 0)
-            output();
-        discharge();
+        if(c % ipf == 0)
+        {
+            if(paced)
+                timers();
+            if(shared)
+                publish();
+        }
+    }
+}
+
+// Boots once, then forks a copy on write child for every test case read from stdin
+// as: <keys hex> <cycles>. Each child holds the keys for the cycles and prints the case
+// number, PC, I, V0-VF and a hash of the screen.
+static void serve()
+{
+    run(forks);
+    unsigned held;
+    long cycles;
+    for(long n = 1; scanf("%x %ld", &held, &cycles) == 2; n++)
+    {
+        fflush(stdout);
+        const pid_t child = fork();
+        if(child == -1)
+        {
+            fprintf(stderr, "error: test case %ld cannot be forked\n", n);
+            exit(1);
+        }
+        if(child == 0)
+        {
+            keys = held;
+            run(cycles);
+            printf("%ld %03X %03X", n, pc, I);
+            for(int i = 0; i < VSIZE; i++)
+                printf(" %02X", v[i]);
+            printf(" %016" PRIx64 "\n", fnv(vmem, sizeof(vmem), 0xCBF29CE484222325));
+            fflush(stdout);
+            if(coverage)
+                export();
+            _exit(0);
+        }
+        waitpid(child, NULL, 0);
     }
-    SDL_Quit();
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
 }
+
+int main(int argc, char* argv[])
+{
+    options(argc, argv);
+    seed = time(0) | 1;
+    if(sharing)
+        share();
+    if(forks)
+    {
+        load(argv[argc - 1]);
+        serve();
+    }
+    else
+    if(headless)
+    {
+        load(argv[argc - 1]);
+        run(headless);
+    }
+    else
+    {
+        SDL_Init(SDL_INIT_VIDEO);
+        SDL_CreateWindowAndRenderer(512, 256, 0, &window, &renderer);
+        SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0x00);
+        SDL_SetWindowTitle(window, "Emu-" VERSION);
+        SDL_RenderClear(renderer);
+        SDL_RenderPresent(renderer);
+        key = SDL_GetKeyboardState(NULL);
+        load(argv[argc - 1]);
+        for(int cycles = 0; scan(); cycles++)
+        {
+            charge();
+            cycle();
+            if(cycles % ipf == 0)
+            {
+                frames > 0 ? runahead() : output();
+                if(paced)
+                    pace();
+                if(shared)
+                    publish();
+                tally(false);
+            }
+            discharge();
+        }
+        SDL_Quit();
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+    }
+    if(coverage)
+        export();
+    if(latencies)
+        report();
+    if(stats)
+        tally(true);
+    if(sharing)
+        shm_unlink(sharing);
+}
+
+#else
+
+static bool scan()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#include <stdint.h>
+
+// What every core exposes to the lockstep runner. The screen is 64x32,
+// one row per word with column 0 in the top bit.
+struct view
+{
+    uint16_t pc;
+    uint16_t i;
+    uint8_t v[16];
+    uint8_t sp;
+    uint8_t dt;
+    uint8_t st;
+};
+
+struct core
+{
+    const char* name;
+    void (*boot)(const char* rom);
+    // Next instruction, before it is stepped.
+    uint16_t (*fetch)();
+    // Runs one instruction with the given keys held. CXNN takes its random byte
+    // from the runner so that every core draws the same numbers.
+    void (*step)(uint16_t keys, uint8_t random);
+    // A 60 Hz timer tick.
+    void (*tick)();
+    void (*view)(struct view*);
+    void (*screen)(uint64_t rows[32]);
+};
+
+extern const struct core emu;
+extern const struct core ref;
+extern const struct core src7;
+extern const struct core src95;
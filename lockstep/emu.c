@@ -0,0 +1,43 @@
+// The predecoded emulator as it runs in the window.
+#define HEADLESS
+#include "../emu.c"
+#include "core.h"
+
+static void boot(const char* rom)
+{
+    database = NULL;
+    paced = true;
+    seed = 1;
+    load(rom);
+}
+
+static uint16_t fetch()
+{
+    return (mem[pc] << 8) + mem[pc + 1];
+}
+
+static void step(const uint16_t held, const uint8_t random)
+{
+    keys = held;
+    const uint16_t o = fetch();
+    cycle();
+    if((o & 0xF000) == 0xC000)
+        v[(o & 0x0F00) >> 8] = random & o;
+}
+
+static void view(struct view* const to)
+{
+    to->pc = pc;
+    to->i = I;
+    memcpy(to->v, v, sizeof(v));
+    to->sp = sp;
+    to->dt = dt;
+    to->st = st;
+}
+
+static void screen(uint64_t rows[32])
+{
+    memcpy(rows, vmem, sizeof(vmem));
+}
+
+const struct core emu = { "emu", boot, fetch, step, timers, view, screen };
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core.h"
+
+static const struct core* cores[] = { &emu, &ref, &src7, &src95 };
+
+#define NCORES (sizeof(cores) / sizeof(*cores))
+
+// Cores stepped together (-c emu,ref,...). The first is the reference.
+static const struct core* running[NCORES];
+
+static unsigned nrunning;
+
+// Instructions to step (-n steps).
+static long steps = 1000000;
+
+// Instructions per timer tick (-i ipf).
+static int ipf = 15;
+
+// Held keys from a given step onward (-k file), one "<step> <keys hex>" per line.
+static struct press
+{
+    long step;
+    uint16_t keys;
+}
+presses[4096];
+
+static int npresses;
+
+// Per core hash of the screen, refreshed only after instructions that draw.
+static uint64_t screens[NCORES];
+
+static uint32_t seed = 1;
+
+static uint8_t rnd()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint64_t mix(uint64_t h, const uint64_t w)
+{
+    h ^= w;
+    h *= 0x100000001B3;
+    return h ^ (h >> 29);
+}
+
+static uint64_t hash(const struct view* const at)
+{
+    uint64_t h = 0xCBF29CE484222325;
+    uint64_t w[2];
+    memcpy(w, at->v, sizeof(w));
+    h = mix(h, w[0]);
+    h = mix(h, w[1]);
+    return mix(h, (uint64_t) at->pc | (uint64_t) at->i << 16 | (uint64_t) at->sp << 32 | (uint64_t) at->dt << 40 | (uint64_t) at->st << 48);
+}
+
+static uint64_t paint(const struct core* const c)
+{
+    uint64_t rows[32];
+    c->screen(rows);
+    uint64_t h = 0xCBF29CE484222325;
+    for(int j = 0; j < 32; j++)
+        h = mix(h, rows[j]);
+    return h;
+}
+
+static int draws(const uint16_t o)
+{
+    return (o & 0xF000) == 0xD000 || o == 0x00E0;
+}
+
+static void compare(const struct core* const a, const struct core* const b)
+{
+    struct view x;
+    struct view y;
+    a->view(&x);
+    b->view(&y);
+    if(x.pc != y.pc) printf("  pc: %s 0x%03X, %s 0x%03X\n", a->name, x.pc, b->name, y.pc);
+    if(x.i != y.i) printf("  i: %s 0x%03X, %s 0x%03X\n", a->name, x.i, b->name, y.i);
+    if(x.sp != y.sp) printf("  sp: %s %d, %s %d\n", a->name, x.sp, b->name, y.sp);
+    if(x.dt != y.dt) printf("  dt: %s %d, %s %d\n", a->name, x.dt, b->name, y.dt);
+    if(x.st != y.st) printf("  st: %s %d, %s %d\n", a->name, x.st, b->name, y.st);
+    for(int i = 0; i < 16; i++)
+        if(x.v[i] != y.v[i])
+            printf("  v[%X]: %s 0x%02X, %s 0x%02X\n", i, a->name, x.v[i], b->name, y.v[i]);
+    uint64_t r[32];
+    uint64_t s[32];
+    a->screen(r);
+    b->screen(s);
+    for(int j = 0; j < 32; j++)
+        if(r[j] != s[j])
+            printf("  row %d: %s %016llX, %s %016llX\n", j, a->name, (unsigned long long) r[j], b->name, (unsigned long long) s[j]);
+}
+
+static void record(const char* file)
+{
+    FILE* const fp = fopen(file, "r");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "error: %s does not exist\n", file);
+        exit(1);
+    }
+    long step;
+    unsigned keys;
+    while(npresses < 4096 && fscanf(fp, "%ld %x", &step, &keys) == 2)
+    {
+        presses[npresses].step = step;
+        presses[npresses].keys = keys;
+        npresses++;
+    }
+    fclose(fp);
+}
+
+static void choose(char* names)
+{
+    for(char* name = strtok(names, ","); name; name = strtok(NULL, ","))
+    {
+        unsigned i;
+        for(i = 0; i < NCORES; i++)
+            if(strcmp(name, cores[i]->name) == 0)
+                break;
+        if(i == NCORES)
+        {
+            fprintf(stderr, "error: unknown core '%s'\n", name);
+            exit(1);
+        }
+        running[nrunning++] = cores[i];
+    }
+}
+
+static void options(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "error: too few or too many argmuents\n");
+        exit(1);
+    }
+    for(int i = 1; i < argc - 1; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc - 1)
+            steps = atol(argv[++i]);
+        else
+        if(strcmp(argv[i], "-i") == 0 && i + 1 < argc - 1)
+            ipf = atoi(argv[++i]);
+        else
+        if(strcmp(argv[i], "-k") == 0 && i + 1 < argc - 1)
+            record(argv[++i]);
+        else
+        if(strcmp(argv[i], "-c") == 0 && i + 1 < argc - 1 && nrunning == 0)
+            choose(argv[++i]);
+        else
+        {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            exit(1);
+        }
+    }
+    if(nrunning == 0)
+        for(unsigned i = 0; i < NCORES; i++)
+            running[nrunning++] = cores[i];
+    if(nrunning < 2 || ipf < 1)
+    {
+        fprintf(stderr, "error: expected two or more cores and a positive ipf\n");
+        exit(1);
+    }
+}
+
+// Steps every core one instruction at a time and stops at the first step
+// after which any core's registers or screen differ from the first core's.
+int main(int argc, char* argv[])
+{
+    options(argc, argv);
+    for(unsigned c = 0; c < nrunning; c++)
+    {
+        running[c]->boot(argv[argc - 1]);
+        screens[c] = paint(running[c]);
+    }
+    uint16_t keys = 0;
+    int next = 0;
+    for(long step = 1; step <= steps; step++)
+    {
+        while(next < npresses && presses[next].step <= step)
+            keys = presses[next++].keys;
+        const uint16_t o = running[0]->fetch();
+        const uint8_t random = rnd();
+        uint64_t first = 0;
+        for(unsigned c = 0; c < nrunning; c++)
+        {
+            const struct core* const core = running[c];
+            const int drawing = draws(core->fetch());
+            core->step(keys, random);
+            if(step % ipf == 0)
+                core->tick();
+            if(drawing)
+                screens[c] = paint(core);
+            struct view now;
+            core->view(&now);
+            const uint64_t h = mix(hash(&now), screens[c]);
+            if(c == 0)
+                first = h;
+            else
+            if(h != first)
+            {
+                printf("%s and %s diverge on step %ld after 0x%04X\n", running[0]->name, core->name, step, o);
+                compare(running[0], core);
+                return 1;
+            }
+        }
+    }
+    printf("%ld steps without divergence\n", steps);
+}
@@ -0,0 +1,58 @@
+// src7 with its quirks set as close to emu's defaults as it allows.
+#include "../src7/chip8.c"
+#include "core.h"
+
+static uint16_t held;
+
+static void boot(const char* rom)
+{
+    c8_reset();
+    c8_set_quirks(QUIRKS_MEM_CHIP8 | QUIRKS_CLIPPING);
+    if(c8_load_file(rom) == 0)
+    {
+        fprintf(stderr, "error: binary '%s' not found\n", rom);
+        exit(1);
+    }
+}
+
+static uint16_t fetch()
+{
+    return c8_opcode(C8.PC);
+}
+
+static void step(const uint16_t now, const uint8_t random)
+{
+    // Keys are reported as they change, the way a window would.
+    for(int k = 0; k < 16; k++)
+        if(((now ^ held) >> k) & 0x1)
+            (now >> k) & 0x1 ? c8_key_down(k) : c8_key_up(k);
+    held = now;
+    const uint16_t o = fetch();
+    c8_step();
+    // DXYN waits for the next frame under QUIRKS_DISP_WAIT only.
+    yield = 0;
+    if((o & 0xF000) == 0xC000)
+        C8.V[(o & 0x0F00) >> 8] = random & o;
+}
+
+static void view(struct view* const to)
+{
+    to->pc = C8.PC;
+    to->i = C8.I;
+    memcpy(to->v, C8.V, sizeof(C8.V));
+    to->sp = C8.SP;
+    to->dt = C8.DT;
+    to->st = C8.ST;
+}
+
+static void screen(uint64_t rows[32])
+{
+    for(int j = 0; j < 32; j++)
+    {
+        rows[j] = 0;
+        for(int i = 0; i < 64; i++)
+            rows[j] = rows[j] << 1 | c8_get_pixel(i, j);
+    }
+}
+
+const struct core src7 = { "src7", boot, fetch, step, c8_60hz_tick, view, screen };
@@ -0,0 +1,81 @@
+// src9-5 one instruction per cycle. Its core shares function names with src7.
+#define c8_reset src95_reset
+#define c8_soft_reset src95_soft_reset
+#define c8_init src95_init
+#define c8_load_rom src95_load_rom
+#define c8_cycle src95_cycle
+#define c8_decrement_timers src95_decrement_timers
+#define c8_sound src95_sound
+#define c8_screen_updated src95_screen_updated
+#define c8_ended src95_ended
+#define c8_get_pixel src95_get_pixel
+#define c8_get_opcode src95_get_opcode
+#define c8_press_key src95_press_key
+#define c8_release_key src95_release_key
+#define c8_set_freq src95_set_freq
+#define c8_set_platform src95_set_platform
+#include "../src9-5/chip8.c"
+#include "core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Chip8 vm;
+
+static void boot(const char* rom)
+{
+    FILE* const fp = fopen(rom, "rb");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "error: binary '%s' not found\n", rom);
+        exit(1);
+    }
+    static unsigned char buf[MAX_ROM_SIZE];
+    const int size = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    c8_init(&vm, GAME_LOOP_FREQ, P_CHIP8, 1);
+    c8_load_rom(&vm, buf, size);
+}
+
+static uint16_t fetch()
+{
+    return (vm.RAM[vm.PC] << 8) | vm.RAM[vm.PC + 1];
+}
+
+static void step(const uint16_t keys, const uint8_t random)
+{
+    for(int k = 0; k < KEYPAD_SIZE; k++)
+        vm.keypad[k] = (keys >> k) & 0x1;
+    const uint16_t o = fetch();
+    c8_cycle(&vm);
+    if((o & 0xF000) == 0xC000)
+        vm.V[(o & 0x0F00) >> 8] = random & o;
+}
+
+static void tick()
+{
+    c8_decrement_timers(&vm);
+}
+
+static void view(struct view* const to)
+{
+    to->pc = vm.PC;
+    to->i = vm.I;
+    memcpy(to->v, vm.V, sizeof(vm.V));
+    to->sp = vm.SP;
+    to->dt = vm.DT;
+    to->st = vm.ST;
+}
+
+// Low resolution pixels are drawn doubled on its 128x64 screen.
+static void screen(uint64_t rows[32])
+{
+    for(int j = 0; j < 32; j++)
+    {
+        rows[j] = 0;
+        for(int i = 0; i < 64; i++)
+            rows[j] = rows[j] << 1 | c8_get_pixel(&vm, 2 * j, 2 * i);
+    }
+}
+
+const struct core src95 = { "src95", boot, fetch, step, tick, view, screen };
@@ -0,0 +1,72 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Must match emu's shared memory layout (-m name).
+struct shared
+{
+    uint32_t sequence;
+    uint32_t unused;
+    uint64_t frame;
+    uint64_t vmem[32];
+    uint16_t pc;
+    uint16_t I;
+    uint8_t v[16];
+    uint8_t dt;
+    uint8_t st;
+    uint8_t sp;
+};
+
+// Copies a consistent snapshot. The copy is retried while emu is writing or wrote during it.
+static void snapshot(const struct shared* const from, struct shared* const to)
+{
+    for(;;)
+    {
+        const uint32_t before = __atomic_load_n(&from->sequence, __ATOMIC_ACQUIRE);
+        memcpy(to, from, sizeof(*to));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        const uint32_t after = __atomic_load_n(&from->sequence, __ATOMIC_RELAXED);
+        if(before == after && (before & 0x1) == 0)
+            return;
+    }
+}
+
+// Prints the frame counter, registers and screen of a running emu.
+int main(int argc, char* argv[])
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "expected shared memory name argument\n");
+        exit(1);
+    }
+    const int fd = shm_open(argv[1], O_RDONLY, 0);
+    if(fd == -1)
+    {
+        fprintf(stderr, "error: shared memory %s does not exist\n", argv[1]);
+        exit(1);
+    }
+    const struct shared* const from = (struct shared*) mmap(NULL, sizeof(*from), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(from == MAP_FAILED)
+    {
+        fprintf(stderr, "error: shared memory %s cannot be mapped\n", argv[1]);
+        exit(1);
+    }
+    struct shared now;
+    snapshot(from, &now);
+    printf("frame %llu pc 0x%03X I 0x%03X dt %d st %d sp %d\n", (unsigned long long) now.frame, now.pc, now.I, now.dt, now.st, now.sp);
+    for(int i = 0; i < 16; i++)
+        printf("%02X%c", now.v[i], i == 15 ? '\n' : ' ');
+    for(int j = 0; j < 32; j++)
+    {
+        for(int i = 0; i < 64; i++)
+            putchar((now.vmem[j] >> (63 - i)) & 0x1 ? '#' : '.');
+        putchar('\n');
+    }
+}
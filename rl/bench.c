@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rl.h"
+
+// Steps n instances of a ROM with random actions and reports frames per second.
+int main(int argc, char* argv[])
+{
+    if(argc != 5)
+    {
+        fprintf(stderr, "expected rom, instances, frames per step and steps arguments\n");
+        exit(1);
+    }
+    const int n = atoi(argv[2]);
+    const int frames = atoi(argv[3]);
+    const long steps = atol(argv[4]);
+    struct rl* const env = rl_make(argv[1], n, 0x0000);
+    uint16_t* const actions = (uint16_t*) calloc(n, sizeof(*actions));
+    const uint64_t** const screens = (const uint64_t**) calloc(n, sizeof(*screens));
+    int* const rewards = (int*) calloc(n, sizeof(*rewards));
+    struct timespec a;
+    struct timespec b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    for(long step = 0; step < steps; step++)
+    {
+        for(int i = 0; i < n; i++)
+            actions[i] = 1 << (rand() & 0xF);
+        rl_step(env, actions, frames, screens, rewards);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    const double seconds = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+    printf("%.0f frames per second\n", n * frames * steps / seconds);
+    free(rewards);
+    free(screens);
+    free(actions);
+    rl_free(env);
+}
@@ -0,0 +1,96 @@
+#define HEADLESS
+#include "../emu.c"
+#include "rl.h"
+
+// The emulator runs one machine at a time, so an instance is switched in for
+// all of its frames and switched out after. Each instance keeps its own
+// predecoded table, which is swapped by pointer rather than copied.
+
+struct rl
+{
+    int n;
+    uint16_t reward;
+    struct state boot;
+    struct state* instances;
+};
+
+static void enter(struct state* const from)
+{
+    memcpy(vmem, from->vmem, sizeof(vmem));
+    memcpy(s, from->s, sizeof(s));
+    memcpy(v, from->v, sizeof(v));
+    memcpy(mem, from->mem, sizeof(mem));
+    decoded = from->decoded;
+    pc = from->pc;
+    I = from->I;
+    dt = from->dt;
+    st = from->st;
+    sp = from->sp;
+    seed = from->seed;
+}
+
+static void leave(struct state* const to)
+{
+    memcpy(to->vmem, vmem, sizeof(vmem));
+    memcpy(to->s, s, sizeof(s));
+    memcpy(to->v, v, sizeof(v));
+    memcpy(to->mem, mem, sizeof(mem));
+    to->pc = pc;
+    to->I = I;
+    to->dt = dt;
+    to->st = st;
+    to->sp = sp;
+    to->seed = seed;
+}
+
+struct rl* rl_make(const char* rom, const int n, const uint16_t reward)
+{
+    struct rl* const env = (struct rl*) calloc(1, sizeof(*env));
+    env->n = n;
+    env->reward = reward & 0x0FFF;
+    env->instances = (struct state*) calloc(n, sizeof(*env->instances));
+    decoded = env->boot.decoded;
+    load(rom);
+    // Every frame ticks the timers once, whether or not the ROM is known.
+    paced = true;
+    leave(&env->boot);
+    for(int i = 0; i < n; i++)
+        rl_reset(env, i);
+    return env;
+}
+
+void rl_free(struct rl* const env)
+{
+    decoded = decodes;
+    free(env->instances);
+    free(env);
+}
+
+void rl_reset(struct rl* const env, const int i)
+{
+    struct state* const at = &env->instances[i];
+    memcpy(at, &env->boot, sizeof(*at));
+    // Instances draw different random numbers.
+    at->seed = 2 * i + 1;
+}
+
+void rl_step(struct rl* const env, const uint16_t actions[], const int frames, const uint64_t* screens[], int rewards[])
+{
+    for(int i = 0; i < env->n; i++)
+    {
+        struct state* const at = &env->instances[i];
+        enter(at);
+        keys = actions[i];
+        for(int f = 0; f < frames; f++)
+        {
+            for(int c = 0; c < ipf; c++)
+                cycle();
+            timers();
+        }
+        leave(at);
+        if(screens)
+            screens[i] = at->vmem;
+        if(rewards)
+            rewards[i] = at->mem[env->reward];
+    }
+}
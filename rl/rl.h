@@ -0,0 +1,23 @@
+#include <stdint.h>
+
+// Batched environments for training bots on CHIP-8 games.
+//
+// Every instance boots the same ROM. An action is the mask of keys held for
+// the whole step, one bit per key. A screen is 32 rows of 64 pixels, one row
+// per word with column 0 in the top bit, exactly as the emulator draws it.
+
+struct rl;
+
+// Boots 'rom' once and starts n instances from that snapshot. The reward of an
+// instance is the byte at RAM address 'reward'. Quirks and instructions per frame
+// come from roms.db when the ROM is known.
+struct rl* rl_make(const char* rom, int n, uint16_t reward);
+
+void rl_free(struct rl*);
+
+// Returns an instance to the snapshot taken right after boot.
+void rl_reset(struct rl*, int i);
+
+// Runs every instance 'frames' frames with its action held. Screens point into the
+// instances and stay valid until the next step or reset. Either output may be NULL.
+void rl_step(struct rl*, const uint16_t actions[], int frames, const uint64_t* screens[], int rewards[]);
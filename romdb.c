@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+// Must match emu's fingerprint database layout.
+struct fingerprint
+{
+    uint64_t hash;
+    uint16_t ipf;
+    uint8_t platform;
+    uint8_t quirks;
+    uint32_t unused;
+};
+
+struct fingerprints
+{
+    char magic[4];
+    uint32_t slots;
+};
+
+static const char* platforms[] = { "chip8", "schip", "xochip" };
+
+static uint64_t fnv(const uint8_t* const bytes, const size_t size)
+{
+    uint64_t h = 0xCBF29CE484222325;
+    for(size_t i = 0; i < size; i++)
+    {
+        h ^= bytes[i];
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+
+// A ROM is named by the path of its binary, or by its 16 hex digit hash.
+static uint64_t identify(const char* rom, const unsigned linenumber)
+{
+    FILE* const fp = fopen(rom, "rb");
+    if(fp)
+    {
+        uint8_t buf[4096];
+        const size_t size = fread(buf, 1, sizeof(buf), fp);
+        fclose(fp);
+        return fnv(buf, size);
+    }
+    if(strlen(rom) == 16 && strspn(rom, "0123456789abcdefABCDEF") == 16)
+        return strtoull(rom, NULL, 16);
+    fprintf(stderr, "error: line %u: ROM %s not found\n", linenumber, rom);
+    exit(1);
+}
+
+static int platform(const char* name, const unsigned linenumber)
+{
+    for(unsigned i = 0; i < sizeof(platforms) / sizeof(*platforms); i++)
+        if(strcmp(name, platforms[i]) == 0)
+            return i;
+    fprintf(stderr, "error: line %u: unknown platform %s\n", linenumber, name);
+    exit(1);
+}
+
+// Quirks are letters: s (shift), m (memory), j (jump), v (vf reset), or - for none.
+static int quirks(const char* letters, const unsigned linenumber)
+{
+    int q = 0;
+    for(const char* c = letters; *c; c++)
+        switch(*c)
+        {
+        case 's': q |= 0x1; break;
+        case 'm': q |= 0x2; break;
+        case 'j': q |= 0x4; break;
+        case 'v': q |= 0x8; break;
+        case '-': break;
+        default:
+            fprintf(stderr, "error: line %u: unknown quirk '%c'\n", linenumber, *c);
+            exit(1);
+        }
+    return q;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 3)
+    {
+        fprintf(stderr, "expected input and output arguments");
+        exit(1);
+    }
+    FILE* const fi = fopen(argv[1], "r");
+    if(fi == NULL)
+    {
+        fprintf(stderr, "error: %s does not exist\n", argv[1]);
+        exit(1);
+    }
+    static struct fingerprint entries[4096];
+    unsigned n = 0;
+    char line[512];
+    for(unsigned linenumber = 1; fgets(line, sizeof(line), fi); linenumber++)
+    {
+        char* hash = strchr(line, '#');
+        if(hash)
+            *hash = '\0';
+        char rom[320], plt[16], q[16];
+        unsigned ipf;
+        const int fields = sscanf(line, "%319s %15s %15s %u", rom, plt, q, &ipf);
+        if(fields <= 0)
+            continue;
+        if(fields != 4)
+        {
+            fprintf(stderr, "error: line %u: expected ROM, platform, quirks and instructions per frame\n", linenumber);
+            exit(1);
+        }
+        if(n == sizeof(entries) / sizeof(*entries))
+        {
+            fprintf(stderr, "error: line %u: too many ROMs\n", linenumber);
+            exit(1);
+        }
+        const struct fingerprint entry = {
+            identify(rom, linenumber), ipf, platform(plt, linenumber), quirks(q, linenumber), 0
+        };
+        entries[n++] = entry;
+    }
+    fclose(fi);
+    // Open addressing at half load or less keeps probes short.
+    uint32_t slots = 1;
+    while(slots < 2 * n)
+        slots <<= 1;
+    struct fingerprint* const table = (struct fingerprint*) calloc(slots, sizeof(*table));
+    for(unsigned i = 0; i < n; i++)
+    {
+        uint32_t at = entries[i].hash & (slots - 1);
+        while(table[at].hash && table[at].hash != entries[i].hash)
+            at = (at + 1) & (slots - 1);
+        table[at] = entries[i];
+    }
+    FILE* const fo = fopen(argv[2], "wb");
+    if(fo == NULL)
+    {
+        fprintf(stderr, "error: %s cannot be made\n", argv[2]);
+        exit(1);
+    }
+    const struct fingerprints header = { "ROM", slots };
+    fwrite(&header, sizeof(header), 1, fo);
+    fwrite(table, sizeof(*table), slots, fo);
+    fclose(fo);
+    free(table);
+}
@@ -0,0 +1,79 @@
+; Host calls only run when the virtual machine is started with -x.
+BUFFER:
+    DB 0x00
+    DB 0x00
+    DB 0x00
+    DB 0x00
+
+MEMSET_TEST:
+    ;----------------------------;
+    ;      SYS 0x101 (MEMSET)    ;
+    ;----------------------------;
+    LD  I, BUFFER
+    LD V0, 0xAB
+    LD V1, 0x03
+    SYS 0x101
+    LD  I, BUFFER
+    LD V3, [I]
+    SE V0, 0xAB
+    LD VE, 0x01
+    SE V1, 0xAB
+    LD VE, 0x01
+    SE V2, 0xAB
+    LD VE, 0x01
+    ; Fourth byte is untouched
+    SE V3, 0x00
+    LD VE, 0x01
+    RET
+
+MUL_TEST:
+    ;----------------------------;
+    ;       SYS 0x103 (MUL)      ;
+    ;----------------------------;
+    LD V0, 0x51
+    LD V1, 0x09
+    SYS 0x103
+    ; 81 * 9 = 729 = 0x02D9
+    SE VF, 0xD9
+    LD VE, 0x01
+    SE V0, 0x02
+    LD VE, 0x01
+    RET
+
+DIV_TEST:
+    ;----------------------------;
+    ;       SYS 0x104 (DIV)      ;
+    ;----------------------------;
+    LD V0, 0x64
+    LD V1, 0x07
+    SYS 0x104
+    ; 100 / 7 = 14 remainder 2
+    SE VF, 0x0E
+    LD VE, 0x01
+    SE V0, 0x02
+    LD VE, 0x01
+    ;----------------------------;
+    ;   SYS 0x104 (DIV) by zero  ;
+    ;----------------------------;
+    LD V0, 0x64
+    LD V1, 0x00
+    SYS 0x104
+    SE VF, 0xFF
+    LD VE, 0x01
+    RET
+
+main:
+    ; VE, if non-zero, indicates test failure
+    LD VE, 0x00
+    ; Test all
+    CALL MEMSET_TEST
+    CALL MUL_TEST
+    CALL DIV_TEST
+    ; Finish - Display VE: the test failure status
+    LD   F, VE
+    LD  V0, 0x01
+    LD  V1, 0x01
+    DRW V0, V1, 0x5
+    ; All is well; stay here forever
+END:
+    JP END